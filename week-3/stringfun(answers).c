@@ -3,10 +3,68 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1     //sse2 / avx2 kernels, picked at runtime
+#endif
 
 
 #define SPACE_CHAR ' '
 
+//streaming mode (-i) reads its input this many bytes at a time, so any
+//size of file or pipe runs in the same small amount of memory
+#define CHUNK_SIZE (64 * 1024)
+
+//upper limit for -j, the number of threads counting one file in parallel
+#define MAX_THREADS 256
+
+//-f prints this many of the most frequent words unless -k says otherwise
+#define FREQ_DEFAULT_TOP 10
+
+//the arena that holds the words for -f grows this many bytes at a time
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+
+//word_print collects its output in a buffer this big before writing it
+#define OUTBUF_SIZE (64 * 1024)
+
+//-x patterns longer than this are searched for with boyer-moore-horspool
+//instead of the first/last byte filter
+#define BMH_MIN_LEN 32
+
+//-s puts words this long or longer in one bucket of the length histogram
+#define STATS_MAX_WLEN 32
+
+//-b times each case this many times and keeps the fastest
+#define BENCH_RUNS 5
+
+//seed for the -b corpora, so every run benchmarks the same bytes
+#define BENCH_SEED 0x5eed5eed5eed5eedULL
+
+//the word separator sets -S knows by name, anything else is a custom set
+#define SEPS_SPACE      " "
+#define SEPS_WHITESPACE " \t\n\v\f\r"
+#define SEPS_PUNCT      " \t\n\v\f\r!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~"
+
+//environment variable that forces a kernel (scalar, sse2 or avx2), so the
+//simd kernels can be checked against the scalar reference
+#define KERNEL_ENV "STRINGFUN_KERNEL"
+
+//environment variable that turns off memory mapped input, so the read()
+//path can be tested and benchmarked on regular files too
+#define NO_MMAP_ENV "STRINGFUN_NO_MMAP"
+
 //prototypes for functions to handle required functionality
 // TODO: #1 What is the purpose of providing prototypes for
 //          the functions in this code module
@@ -19,13 +77,180 @@
 
 void  usage(char *);
 int   count_words(char *);
+size_t count_words_buf(const char *, size_t, bool *);
+size_t count_words_scalar(const char *, size_t, bool *);
+int   sep_set_use(const char *);
 void  reverse_string(char *);
+void  reverse_buf(char *, size_t);
+void  reverse_buf_scalar(char *, size_t);
+int   reverse_file(const char *);
 void  word_print(char *);
+int   open_input(const char *);
+ssize_t read_chunk(int, char *, size_t);
+
+//a regular file mapped into memory by map_input().  data and len are the
+//part of it from the file offset on, base and size the whole mapping.
+typedef struct mapping {
+    void *base;
+    size_t size;
+    const char *data;
+    size_t len;
+} mapping_t;
+
+int   map_input(int, mapping_t *);
+void  unmap_input(mapping_t *);
+int   stream_count_words(int, bool, size_t *);
+int   stream_reverse(int, bool);
+int   reverse_words(char *, size_t, bool);
+int   stream_reverse_words(int, bool);
+int   stream_word_print(int, bool);
+int   parallel_count_words(int, int, size_t *);
+size_t count_words_utf8(const char *, size_t, bool *);
+void  reverse_utf8(char *, size_t);
+
+//options that follow -c/-r/-w on the command line, filled in by main()
+typedef struct stream_opts {
+    const char *path;   //-i, file to read, "-" for stdin, NULL for argv
+    int threads;        //-j, threads for -c (0 = one per cpu)
+    bool in_place;      //--in-place, -r rewrites the file itself
+    bool utf8;          //-u, utf-8 characters and unicode whitespace
+    long top;           //-k, words -f prints (0 = all, -1 = default)
+    bool by_key;        //--by-key, -f prints in word order
+    const char *find;   //-x, text to search for
+    const char *replace;//-x, text to put in its place
+    const char **paths; //-i, every file named after it
+    size_t npaths;
+    bool list;          //-L, read more file names from stdin
+} stream_opts_t;
+
+int   run_stream(char, const stream_opts_t *);
+
+//word_print() state that has to survive from one chunk to the next when
+//the input is streamed: the word number, the length of the word being
+//printed and whether the last byte seen was inside a word
+typedef struct word_print_state {
+    size_t wc;
+    size_t wlen;
+    bool word_start;
+} word_print_state_t;
+
+void  word_print_buf(const char *, size_t, word_print_state_t *);
+void  word_print_end(word_print_state_t *);
+void  word_print_utf8_buf(const char *, size_t, word_print_state_t *);
+
+//bump allocator for the words in a freq_table_t.  Memory comes from big
+//blocks and is only ever given back all at once, so adding a word costs
+//a pointer bump instead of a malloc().
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} arena_block_t;
+
+typedef struct arena {
+    arena_block_t *head;
+} arena_t;
+
+//one word in a freq_table_t, word points into the table's arena
+typedef struct freq_entry {
+    const char *word;
+    size_t len;
+    uint64_t hash;
+    size_t count;
+} freq_entry_t;
+
+//word -> count table for -f.  Open addressing with linear probing, at
+//most 3/4 full.  pending holds a word that ran off the end of the last
+//buffer, until freq_add_buf() sees where it ends.
+typedef struct freq_table {
+    freq_entry_t *slots;
+    size_t cap;
+    size_t used;
+    arena_t arena;
+    char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+} freq_table_t;
+
+int   freq_init(freq_table_t *);
+void  freq_free(freq_table_t *);
+int   freq_add(freq_table_t *, const char *, size_t, size_t);
+int   freq_add_buf(freq_table_t *, const char *, size_t, bool);
+int   freq_finish(freq_table_t *);
+int   freq_merge(freq_table_t *, const freq_table_t *);
+int   freq_print(const freq_table_t *, long, bool);
+int   stream_freq(int, bool, freq_table_t *);
+int   parallel_freq(int, int, freq_table_t *);
+
+//a compiled -x search pattern, skip is the horspool shift table that is
+//only filled in for patterns of BMH_MIN_LEN bytes or more
+typedef struct matcher {
+    const char *needle;
+    size_t len;
+    size_t skip[256];
+} matcher_t;
+
+void  matcher_init(matcher_t *, const char *, size_t);
+const char *matcher_find(const matcher_t *, const char *, size_t);
+size_t replace_buf(const matcher_t *, const char *, size_t, const char *, size_t,
+                   bool, size_t *);
+int   stream_replace(int, const matcher_t *, const char *, size_t *);
+
+//character classes counted by -s
+enum { CLS_LETTER, CLS_DIGIT, CLS_SPACE, CLS_PUNCT, CLS_OTHER, CLS_COUNT };
+
+//results for -s, built up a chunk at a time like word_print_state_t
+typedef struct text_stats {
+    size_t bytes;
+    size_t words;
+    size_t cls[CLS_COUNT];
+    size_t wlen_hist[STATS_MAX_WLEN + 1];   //[n] = words n long, [0] unused
+    size_t wlen;        //length so far of the word being read
+    bool in_word;
+} text_stats_t;
+
+//everything a combined run like -cws works out in its one pass
+typedef struct fused {
+    bool count, print, reverse, stats;
+    size_t wc;
+    bool in_word;
+    word_print_state_t wp;
+    text_stats_t ts;
+} fused_t;
+
+void  stats_buf(text_stats_t *, const char *, size_t);
+void  stats_print(text_stats_t *);
+void  fused_buf(fused_t *, const char *, size_t);
+int   run_fused(const char *, const stream_opts_t *, char *);
+int   count_fd(int, char *, bool, size_t *);
+int   run_files(char, const stream_opts_t *);
+int   bench_suite(size_t);
 
 
 void usage(char *exename){
-    printf("usage: %s [-h|c|r|w] \"string\" \n", exename);
+    printf("usage: %s [-h|c|r|R|w|f] \"string\" [options]\n", exename);
+    printf("       %s [-c|r|R|w|f] -i [file|-] [options]\n", exename);
+    printf("       (-R reverses the order of the words)\n");
+    printf("       %s -x find replace [\"string\" | -i [file|-]]\n", exename);
+    printf("       %s -[c|w|r|s]...    any mix of these in one pass, e.g. -cws\n", exename);
+    printf("                       (s = length histogram and character classes)\n");
+    printf("       %s -b [MB]          (benchmark suite, csv on stdout)\n", exename);
+    printf("options:\n");
+    printf("       -u              utf-8 characters and unicode whitespace\n");
+    printf("       -S set          split words on space (default), whitespace,\n");
+    printf("                       punct or the characters in set (\\t \\n \\r)\n");
+    printf("       -j threads      -c/-f a file in parallel (0 = one per cpu)\n");
+    printf("       --in-place      -r rewrites the file itself\n");
+    printf("       -k N            -f prints the N most frequent words (0 = all)\n");
+    printf("       --by-key        -f prints the words in byte order\n");
+    printf("       -i f1 f2 ...    -c counts every file, -j threads at a time\n");
+    printf("       -L              -c also counts the files listed on stdin\n");
     printf("\texample: %s -w \"hello class\" \n", exename);
+    printf("\texample: %s -c -i words.txt \n", exename);
+    printf("\texample: find . -name '*.txt' | %s -c -L -j 8 \n", exename);
+    printf("\texample: %s -f -i words.txt -k 20 \n", exename);
+    printf("\texample: %s -x cat dog -i pets.txt > dogs.txt \n", exename);
 }
 
 //count_words algorithm
@@ -47,20 +272,18 @@ void usage(char *exename){
 //  3.  The current word count for the input string is in the wc variable
 //      so just 'return wc;' 
 
-int count_words(char *str){
-    // Suggested local variables
-    int len; // length of string
-    int wc; //  word count
-    bool word_start; // to count the start of the word
-
-    // Please implement
-    //initializing all three local variables
-    word_start = false; //initializing to false
-    len = strlen(str); // Using C based strlen, to get the length of string
-    wc = 0;
+//count_words_scalar() is the algorithm above working on a buffer and length
+//instead of a C string.  *in_word says whether the byte before buf was
+//part of a word, and is updated to say whether the last byte of buf is.
+//That lets a caller count a large input a piece at a time and still get
+//the same count as one call over the whole thing.  This is the reference
+//version, the simd versions below must always agree with it.
+size_t count_words_scalar(const char *buf, size_t len, bool *in_word){
+    size_t wc = 0;      //word count
+    bool word_start = *in_word;
 
-    for (int i = 0; i < len; i++) {
-        char ch = str[i];
+    for (size_t i = 0; i < len; i++) {
+        char ch = buf[i];
 
         if (word_start == false) // if its not the start of word
         {
@@ -69,20 +292,277 @@ int count_words(char *str){
                 wc++;   //increment word count by 1
                 word_start = true; //shows that we are at the start of the word
             }
-            else
-                continue; // if character is a space, we continue to the next block of code
         }
         else 
         {
            if (ch == SPACE_CHAR) // if it is the start of word
                 word_start = false; 
         }
-        
     }
 
+    *in_word = word_start;
+    return wc;
+}
+
+#ifdef HAVE_X86_SIMD
+//simd count_words() - instead of walking a byte at a time, compare a whole
+//block of 16 (sse2) or 32 (avx2) bytes against SPACE_CHAR at once and turn
+//the result into a bitmask with one bit per byte, set for word bytes.
+//A word starts at every word byte whose previous byte is not a word byte:
+//
+//      starts = word & ~((word << 1) | carry)
+//
+//where carry is the word bit of the last byte of the previous block.  The
+//number of words in the block is then just popcount(starts), and there
+//are no branches on the data at all.  The bytes left over at the end are
+//handed to the scalar version.
+size_t count_words_sse2(const char *buf, size_t len, bool *in_word){
+    const __m128i space = _mm_set1_epi8(SPACE_CHAR);
+    unsigned int carry = *in_word;
+    size_t wc = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        unsigned int word = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, space)) & 0xFFFF;
+        unsigned int starts = word & ~((word << 1) | carry);
+
+        wc += __builtin_popcount(starts);
+        carry = word >> 15;
+    }
+
+    *in_word = carry;
+    return wc + count_words_scalar(buf + i, len - i, in_word);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t count_words_avx2(const char *buf, size_t len, bool *in_word){
+    const __m256i space = _mm256_set1_epi8(SPACE_CHAR);
+    unsigned int carry = *in_word;
+    size_t wc = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned int word = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, space));
+        unsigned int starts = word & ~((word << 1) | carry);
+
+        wc += __builtin_popcount(starts);
+        carry = word >> 31;
+    }
+
+    *in_word = carry;
+    return wc + count_words_sse2(buf + i, len - i, in_word);
+}
+#endif
+
+//SEPARATOR SETS (-S)
+//
+//By default SPACE_CHAR is the only thing that separates words, as the
+//assignment says, and the kernels above are hard wired for it.  -S picks
+//a different set: "whitespace", "punct" (whitespace and ASCII
+//punctuation) or a custom list of characters, where \t, \n, \r and a
+//doubled backslash stand for the characters that are awkward to type.
+//The set is compiled once into a 256 entry table, so testing a byte is
+//one load however big the set is.
+//
+//For the simd kernels the set is compiled again into two 16 byte tables
+//for pshufb, one indexed by the low nibble of a byte and one by the high
+//nibble.  hi[h] is the bit 1 << h and lo[l] has bit h set when the byte
+//(h << 4) | l is a separator, so a byte is a separator exactly when
+//lo[low nibble] & hi[high nibble] is not zero.  That is two shuffles and
+//an and for 16 or 32 bytes at a time.  There are only 8 bits, so it only
+//works for sets of ASCII characters; any other set uses the table.
+typedef struct sep_set {
+    bool custom;                //false while the set is just SPACE_CHAR
+    bool ascii;                 //every separator is below 0x80
+    unsigned char table[256];   //1 for the bytes that separate words
+    unsigned char lo[16];
+    unsigned char hi[16];
+} sep_set_t;
+
+static sep_set_t seps = { .table = { [SPACE_CHAR] = 1 } };
+
+#define IS_SEP(c) (seps.table[(unsigned char)(c)] != 0)
+
+//find_sep() - the first separator in p[0..n), or NULL
+static inline const char *find_sep(const char *p, size_t n){
+    if (!seps.custom)
+        return memchr(p, SPACE_CHAR, n);
+    for (size_t i = 0; i < n; i++)
+        if (IS_SEP(p[i]))
+            return p + i;
+    return NULL;
+}
+
+//count_words_set_scalar() - count_words_scalar() for the -S set
+size_t count_words_set_scalar(const char *buf, size_t len, bool *in_word){
+    bool word_start = *in_word;
+    size_t wc = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        bool sep = IS_SEP(buf[i]);
+
+        if (!sep && !word_start)
+            wc++;
+        word_start = !sep;
+    }
+
+    *in_word = word_start;
     return wc;
 }
 
+#ifdef HAVE_X86_SIMD
+//the same block scheme as count_words_sse2(), with the nibble tables
+//standing in for the compare with SPACE_CHAR
+__attribute__((target("ssse3,popcnt")))
+size_t count_words_set_ssse3(const char *buf, size_t len, bool *in_word){
+    const __m128i lo = _mm_loadu_si128((const __m128i *)seps.lo);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)seps.hi);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    unsigned int carry = *in_word;
+    size_t wc = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i sep = _mm_and_si128(l, h);
+        unsigned int word = _mm_movemask_epi8(_mm_cmpeq_epi8(sep, _mm_setzero_si128()));
+        unsigned int starts = word & ~((word << 1) | carry);
+
+        wc += __builtin_popcount(starts);
+        carry = word >> 15;
+    }
+
+    *in_word = carry;
+    return wc + count_words_set_scalar(buf + i, len - i, in_word);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t count_words_set_avx2(const char *buf, size_t len, bool *in_word){
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)seps.lo));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)seps.hi));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    unsigned int carry = *in_word;
+    size_t wc = 0;
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+        __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i sep = _mm256_and_si256(l, h);
+        unsigned int word = _mm256_movemask_epi8(_mm256_cmpeq_epi8(sep, _mm256_setzero_si256()));
+        unsigned int starts = word & ~((word << 1) | carry);
+
+        wc += __builtin_popcount(starts);
+        carry = word >> 31;
+    }
+
+    *in_word = carry;
+    return wc + count_words_set_ssse3(buf + i, len - i, in_word);
+}
+#endif
+
+//the kernel for the -S set, picked by sep_set_use()
+static size_t (*count_words_set)(const char *, size_t, bool *) = count_words_set_scalar;
+
+//sep_set_use() - makes spec ("space", "whitespace", "punct" or a list of
+//characters) the set every operation splits words on.  Call it before
+//any threads start.  Returns -1 for an empty set.
+int sep_set_use(const char *spec){
+    sep_set_t set;
+    const char *chars = spec;
+
+    if (strcmp(spec, "space") == 0)
+        chars = SEPS_SPACE;
+    else if (strcmp(spec, "whitespace") == 0)
+        chars = SEPS_WHITESPACE;
+    else if (strcmp(spec, "punct") == 0)
+        chars = SEPS_PUNCT;
+
+    memset(&set, 0, sizeof(set));
+    set.ascii = true;
+    for (const char *p = chars; *p != '\0'; p++) {
+        unsigned char c = *p;
+
+        if (c == '\\' && chars == spec && p[1] != '\0') {
+            p++;
+            c = *p == 't' ? '\t' : *p == 'n' ? '\n' : *p == 'r' ? '\r' : *p;
+        }
+        set.table[c] = 1;
+        if (c >= 0x80)
+            set.ascii = false;
+        else
+            set.lo[c & 0x0F] |= 1 << (c >> 4);
+    }
+    for (int h = 0; h < 8; h++)
+        set.hi[h] = 1 << h;
+
+    int n = 0;
+    for (int c = 0; c < 256; c++)
+        n += set.table[c];
+    if (n == 0)
+        return -1;
+    set.custom = !(n == 1 && set.table[SPACE_CHAR]);
+    seps = set;
+
+    count_words_set = count_words_set_scalar;
+#ifdef HAVE_X86_SIMD
+    const char *forced = getenv(KERNEL_ENV);
+
+    if (seps.ascii && (forced == NULL || strcmp(forced, "scalar") != 0)) {
+        if ((forced == NULL || strcmp(forced, "sse2") != 0) &&
+            __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+            count_words_set = count_words_set_avx2;
+        else if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt"))
+            count_words_set = count_words_set_ssse3;
+    }
+#endif
+    return 0;
+}
+
+//the count_words kernel to use, picked once: avx2 if the cpu has it, else
+//sse2, else the scalar loop.  KERNEL_ENV can force one of them.
+typedef size_t (*count_words_fn)(const char *, size_t, bool *);
+
+static count_words_fn pick_count_words(void){
+#ifdef HAVE_X86_SIMD
+    const char *forced = getenv(KERNEL_ENV);
+
+    if (forced != NULL && strcmp(forced, "scalar") == 0)
+        return count_words_scalar;
+    if (forced != NULL && strcmp(forced, "sse2") == 0)
+        return count_words_sse2;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return count_words_avx2;
+    return count_words_sse2;
+#else
+    return count_words_scalar;
+#endif
+}
+
+//count_words_buf() - counts the words in buf using the best kernel for
+//this machine and the -S set, see count_words_scalar() for what *in_word
+//means
+size_t count_words_buf(const char *buf, size_t len, bool *in_word){
+    static count_words_fn kernel = NULL;
+
+    if (seps.custom)
+        return count_words_set(buf, len, in_word);
+    if (kernel == NULL)
+        kernel = pick_count_words();
+    return kernel(buf, len, in_word);
+}
+
+int count_words(char *str){
+    bool in_word = false;   //the string starts outside of a word
+
+    return (int)count_words_buf(str, strlen(str), &in_word);
+}
+
 //reverse_string() algorithm
 //  1.  Initialize the start and end index variables
 //      a.  end_idx is the length of str - 1.  We want to remove one
@@ -99,30 +579,127 @@ int count_words(char *str){
 //
 //  3. When the loop above terminates, the string should be reversed in place
 
-void reverse_string(char *str) {
-    // Suggested local variables
-    int end_idx;        //should be length of string - 1
-    int start_idx;      
+//reverse_buf_scalar() is the algorithm above on a buffer and a length, so
+//it also works on a chunk of a file that is not '\0' terminated.  This is
+//the reference version, the simd versions below must always agree with it.
+void reverse_buf_scalar(char *buf, size_t len) {
+    size_t end_idx;     //last character index
+    size_t start_idx;   //first character index
     char tmp_char;
 
-    // Please implement
-    // Initializing local variables
-    end_idx = strlen(str)-1;  //last character index
-    start_idx = 0;   //starting index is set to 0
+    if (len < 2)
+        return;
+
+    end_idx = len - 1;
+    start_idx = 0;
 
     while(end_idx > start_idx) {
         // swapping characters
-        tmp_char = str[start_idx];
-        str[start_idx] = str[end_idx];
-        str[end_idx] = tmp_char;
+        tmp_char = buf[start_idx];
+        buf[start_idx] = buf[end_idx];
+        buf[end_idx] = tmp_char;
 
         // increment front letters by 1 and decrement last letters by 1 until they meet in the middle
         start_idx++;
         end_idx--;
 
     }
+}
+
+#ifdef HAVE_X86_SIMD
+//simd reverse_buf() - the same swap from both ends, but a block of 16
+//(sse2) or 32 (avx2) bytes at a time: load a block from the front and one
+//from the back, reverse the bytes inside each block and store each one
+//where the other came from.  When less than two blocks are left in the
+//middle the scalar loop finishes them off.
+//
+//sse2 has no byte shuffle, so a block is reversed in three steps: reverse
+//the four 32 bit lanes, swap the 16 bit halves of each lane, then swap the
+//two bytes of each 16 bit half.
+static inline __m128i reverse_block_sse2(__m128i v){
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+void reverse_buf_sse2(char *buf, size_t len){
+    char *front = buf;
+    char *back = buf + len;
+
+    while (back - front >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)front);
+        __m128i b = _mm_loadu_si128((const __m128i *)(back - 16));
+
+        _mm_storeu_si128((__m128i *)front, reverse_block_sse2(b));
+        _mm_storeu_si128((__m128i *)(back - 16), reverse_block_sse2(a));
+        front += 16;
+        back -= 16;
+    }
+    reverse_buf_scalar(front, back - front);
+}
+
+//avx2 - vpshufb reverses the bytes inside each 16 byte half, then the
+//two halves trade places
+__attribute__((target("avx2")))
+static inline __m256i reverse_block_avx2(__m256i v){
+    const __m256i rev = _mm256_setr_epi8(
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+        15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+    v = _mm256_shuffle_epi8(v, rev);
+    return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+__attribute__((target("avx2")))
+void reverse_buf_avx2(char *buf, size_t len){
+    char *front = buf;
+    char *back = buf + len;
+
+    while (back - front >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)front);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(back - 32));
+
+        _mm256_storeu_si256((__m256i *)front, reverse_block_avx2(b));
+        _mm256_storeu_si256((__m256i *)(back - 32), reverse_block_avx2(a));
+        front += 32;
+        back -= 32;
+    }
+    reverse_buf_sse2(front, back - front);
+}
+#endif
+
+//the reverse_buf kernel to use, picked the same way as count_words
+typedef void (*reverse_buf_fn)(char *, size_t);
+
+static reverse_buf_fn pick_reverse_buf(void){
+#ifdef HAVE_X86_SIMD
+    const char *forced = getenv(KERNEL_ENV);
+
+    if (forced != NULL && strcmp(forced, "scalar") == 0)
+        return reverse_buf_scalar;
+    if (forced != NULL && strcmp(forced, "sse2") == 0)
+        return reverse_buf_sse2;
+    if (__builtin_cpu_supports("avx2"))
+        return reverse_buf_avx2;
+    return reverse_buf_sse2;
+#else
+    return reverse_buf_scalar;
+#endif
+}
+
+//reverse_buf() - reverses len bytes of buf in place using the best kernel
+//for this machine
+void reverse_buf(char *buf, size_t len){
+    static reverse_buf_fn kernel = NULL;
 
-    return;
+    if (kernel == NULL)
+        kernel = pick_reverse_buf();
+    kernel(buf, len);
+}
+
+void reverse_string(char *str) {
+    reverse_buf(str, strlen(str));
 }
 
 //word_print() - algorithm
@@ -161,134 +738,2629 @@ void reverse_string(char *str) {
 // 3. is (2)
 // 4. fun (3)
 
-void  word_print(char *str){
-    //suggested local variables
-    int len;            //length of string - aka strlen(str);
-    int last_char_idx;  //index of last char - strlen(str)-1;
-    int wc = 0;         //counts words
-    int wlen = 0;       //length of current word
-    bool word_start = false;    //am I at the start of a new word
+//OUTPUT BUFFER
+//
+//word_print used to make a printf() call per character and another per
+//word, and on a big input nearly all of its time went on stdio.  Output
+//now goes into one reusable buffer instead: words are copied in whole,
+//numbers are formatted by hand, and the buffer is handed to write() when
+//it fills up.  A word too big for what is left of the buffer is sent
+//along with the buffer in a single writev() rather than being copied.
+static char out_buf[OUTBUF_SIZE];
+static size_t out_len;
+
+//write_all() - writes every iov, retrying short and interrupted writes
+static int write_all(int fd, struct iovec *iov, int cnt){
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+//out_flush() - writes out the buffer.  Anything printf() has buffered
+//came first, so stdout is flushed before the buffer is.
+static int out_flush(void){
+    struct iovec iov = { out_buf, out_len };
+
+    fflush(stdout);
+    out_len = 0;
+    return write_all(STDOUT_FILENO, &iov, 1);
+}
+
+static int out_put(const char *data, size_t len){
+    if (len <= OUTBUF_SIZE - out_len) {
+        memcpy(out_buf + out_len, data, len);
+        out_len += len;
+        return 0;
+    }
+    if (len < OUTBUF_SIZE) {
+        if (out_flush() < 0)
+            return -1;
+        memcpy(out_buf, data, len);
+        out_len = len;
+        return 0;
+    }
+
+    struct iovec iov[2] = { { out_buf, out_len }, { (char *)data, len } };
+
+    fflush(stdout);
+    out_len = 0;
+    return write_all(STDOUT_FILENO, iov, 2);
+}
+
+//out_uint() - appends v in decimal, two digits per step from a table
+static int out_uint(size_t v){
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, pairs + v * 2, 2);
+    } else {
+        *--p = '0' + v;
+    }
+    return out_put(p, tmp + sizeof(tmp) - p);
+}
+
+//the "N. " in front of a word and the " (len)" after it
+static void out_word_start(word_print_state_t *st){
+    st->wc++;
+    st->word_start = true;
+    st->wlen = 0;
+    out_uint(st->wc);
+    out_put(". ", 2);
+}
 
-    // Please implement
-    len = strlen(str);
-    last_char_idx = len -1;
+static void out_word_end(word_print_state_t *st){
+    out_put(" (", 2);
+    out_uint(st->wlen);
+    out_put(")\n", 2);
+    st->word_start = false;
+    st->wlen = 0;
+}
 
-    for (int i = 0; i < len; i++) {
-        char ch = str[i];
+//word_print_buf() is word_print() on a buffer and a length.  Everything
+//it needs to pick up where it left off is kept in *st, so feeding it an
+//input one chunk at a time prints exactly what one call over the whole
+//input would.  A word that is still open at the end of buf is finished by
+//the next call, or by word_print_end() once there is no more input.
+//Each word is found with memchr() and copied out in one piece.
+void word_print_buf(const char *buf, size_t len, word_print_state_t *st){
+    size_t i = 0;
 
+    while (i < len) {
         // Check if we are at the beginning of a new word
-        if (word_start == false) 
+        if (st->word_start == false)
         {
-            if (ch != SPACE_CHAR)   
-            {
-                wc++;               // Increment word count
-                word_start = true;  // Set word_start
-                wlen = 0;           // Reset the word length
-                printf("%d. ", wc); // Print the word number
-            }    
-            else
-                continue;  // if character is a space, we continue to the next block of code
+            if (IS_SEP(buf[i])) {
+                i++;
+                continue;
+            }
+            out_word_start(st);
         }
 
-        // If we are inside a word
-        if(word_start == true){
-            if (ch != SPACE_CHAR)  //If there is no space character
-            {
-                printf("%c", ch);
-                wlen++;
-            } 
-            else  //If space character is found 
-            {
-                printf(" (%d)\n", wlen); //Print word length
-                word_start = false;  //Reset word_start
-                wlen = 0;  //Reset word length
-            } 
-        }
+        // If we are inside a word, it runs to the next separator
+        const char *space = find_sep(buf + i, len - i);
+        size_t end = space != NULL ? (size_t)(space - buf) : len;
 
-        //Handling the last word if it's not followed by a space
-        if (i == last_char_idx && word_start == true) {
-            printf(" (%d)\n", wlen);
-            //Added the last two to reset word_start and length but the code was working even without them
-            word_start = false;
-            wlen = 0;
+        out_put(buf + i, end - i);
+        st->wlen += end - i;
+        i = end;
+
+        if (space != NULL) {
+            out_word_end(st);
+            i++;
         }
-        
     }
+}
 
-    return;
+//word_print_end() - handles the last word if it's not followed by a
+//space, and writes out everything that is still buffered
+void word_print_end(word_print_state_t *st){
+    if (st->word_start == true)
+        out_word_end(st);
+    out_flush();
 }
 
+void  word_print(char *str){
+    word_print_state_t st = {0, 0, false};
 
-int main(int argc, char *argv[]){
-    char *input_string;     //holds the string provided by the user on cmd line
-    char *opt_string;       //holds the option string in argv[1]
-    char opt;               //used to capture user option from cmd line
+    word_print_buf(str, strlen(str), &st);
+    word_print_end(&st);
+}
 
-    //THIS BLOCK OF CODE HANDLES PROCESSING COMMAND LINE ARGS
-    if (argc < 2){
-        usage(argv[0]);
-        exit(1);
+//UTF-8 MODE (-u)
+//
+//Without -u a "character" is a byte and only SPACE_CHAR (or the -S set)
+//separates words.  With -u the input is treated as
+//UTF-8: reverse keeps each multi-byte character in one piece, word_print
+//counts characters instead of bytes, and words are separated by any ASCII
+//or Unicode whitespace (tab, newline, no-break space, ideographic space
+//and so on).  Bytes that are not valid UTF-8 are each treated as a single
+//non-space character and passed through untouched.
+
+//is_utf8_space() - is code point cp whitespace
+static bool is_utf8_space(unsigned int cp){
+    if (cp < 0x80)
+        return cp == ' ' || (cp >= '\t' && cp <= '\r');
+    return cp == 0x85 || cp == 0xA0 || cp == 0x1680 ||
+           (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 || cp == 0x2029 ||
+           cp == 0x202F || cp == 0x205F || cp == 0x3000;
+}
+
+//utf8_seq_len() - the length of the sequence that lead byte c starts, or
+//0 if c can't start one (a continuation byte or an invalid byte)
+static size_t utf8_seq_len(unsigned char c){
+    if (c < 0x80)
+        return 1;
+    if (c >= 0xC2 && c <= 0xDF)
+        return 2;
+    if (c >= 0xE0 && c <= 0xEF)
+        return 3;
+    if (c >= 0xF0 && c <= 0xF4)
+        return 4;
+    return 0;
+}
+
+#define IS_UTF8_CONT(c) (((unsigned char)(c) & 0xC0) == 0x80)
+
+//utf8_decode() - decodes the character at s, which has n bytes left, into
+//*cp and returns its length in bytes.  A malformed sequence comes back as
+//its first byte on its own with *cp set to U+FFFD.
+static size_t utf8_decode(const unsigned char *s, size_t n, unsigned int *cp){
+    size_t len = utf8_seq_len(s[0]);
+
+    if (len == 1) {
+        *cp = s[0];
+        return 1;
     }
-    opt_string = argv[1];
+    if (len == 0 || len > n)
+        goto bad;
+    for (size_t i = 1; i < len; i++)
+        if (!IS_UTF8_CONT(s[i]))
+            goto bad;
+    //overlong forms, surrogates and code points past U+10FFFF
+    if ((s[0] == 0xE0 && s[1] < 0xA0) || (s[0] == 0xED && s[1] > 0x9F) ||
+        (s[0] == 0xF0 && s[1] < 0x90) || (s[0] == 0xF4 && s[1] > 0x8F))
+        goto bad;
 
-    //note arv[2] should be -h -r -w or -c, thus the option is
-    //the second character and a - is the first char
-    if((opt_string[0] != '-') && (strlen(opt_string) != 2)){
-        usage(argv[0]);
-        exit(1);
+    *cp = s[0] & (0x7F >> len);
+    for (size_t i = 1; i < len; i++)
+        *cp = (*cp << 6) | (s[i] & 0x3F);
+    return len;
+
+bad:
+    *cp = 0xFFFD;
+    return 1;
+}
+
+//utf8_tail_len() - the number of bytes at the end of buf that are the
+//start of a character whose other bytes have not been read yet.  Streaming
+//mode holds those back and puts them in front of the next chunk.
+static size_t utf8_tail_len(const char *buf, size_t len){
+    for (size_t back = 1; back <= 3 && back <= len; back++) {
+        unsigned char c = buf[len - back];
+
+        if (IS_UTF8_CONT(c))
+            continue;
+        return utf8_seq_len(c) > back ? back : 0;
     }
+    return 0;
+}
 
-    opt = opt_string[1];   //get the option flag
+//count_words_utf8() - count_words_buf() for utf-8 text, with *in_word
+//meaning the same thing.  Blocks of 16 bytes with no high bit set are pure
+//ASCII and are done the same way as count_words_sse2(), only with tab to
+//carriage return counted as spaces too.  Anything else is decoded a
+//character at a time until the end of the block.
+size_t count_words_utf8(const char *buf, size_t len, bool *in_word){
+    const unsigned char *s = (const unsigned char *)buf;
+    bool word_start = *in_word;
+    size_t wc = 0;
+    size_t i = 0;
 
-    //handle the help flag and then exit normally
-    if (opt == 'h'){
-        usage(argv[0]);
-        exit(0);
+    while (i < len) {
+        size_t stop = i + 16 < len ? i + 16 : len;
+
+#ifdef HAVE_X86_SIMD
+        if (i + 16 <= len) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+
+            if (_mm_movemask_epi8(v) == 0) {
+                __m128i sp = _mm_or_si128(
+                    _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                    _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1))));
+                unsigned int word = ~_mm_movemask_epi8(sp) & 0xFFFF;
+                unsigned int starts = word & ~((word << 1) | word_start);
+
+                wc += __builtin_popcount(starts);
+                word_start = word >> 15;
+                i += 16;
+                continue;
+            }
+        }
+#endif
+        //a character can run past stop, the next block starts after it
+        while (i < stop) {
+            unsigned int cp;
+            bool space;
+
+            i += utf8_decode(s + i, len - i, &cp);
+            space = is_utf8_space(cp);
+            if (!space && !word_start)
+                wc++;
+            word_start = !space;
+        }
     }
 
-    //Finally the input string must be in argv[2]
-    if (argc != 3){
-        usage(argv[0]);
-        exit(1);
+    *in_word = word_start;
+    return wc;
+}
+
+//utf8_fix_sequences() - after a byte reverse every multi-byte character
+//is backwards too, continuation bytes first and the lead byte last.  Put
+//each one back the right way round.  A run of continuation bytes only
+//counts as a character if the byte after it is a lead byte for exactly
+//that many and utf8_decode() takes the turned round bytes as one
+//character, so invalid input, surrogates and overlong forms included, is
+//left as it was, the same as -c, -w and -f see it.
+static void utf8_fix_sequences(char *buf, size_t len){
+    size_t i = 0;
+
+    while (i < len) {
+#ifdef HAVE_X86_SIMD
+        if (i + 16 <= len &&
+            _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(buf + i))) == 0) {
+            i += 16;
+            continue;
+        }
+#endif
+        if (!IS_UTF8_CONT(buf[i])) {
+            i++;
+            continue;
+        }
+
+        size_t j = i;
+        while (j < len && j - i < 3 && IS_UTF8_CONT(buf[j]))
+            j++;
+        if (j < len && utf8_seq_len(buf[j]) == j - i + 1) {
+            unsigned char seq[4];
+            unsigned int cp;
+
+            for (size_t k = 0; k <= j - i; k++)
+                seq[k] = buf[j - k];
+            if (utf8_decode(seq, j - i + 1, &cp) == j - i + 1) {
+                memcpy(buf + i, seq, j - i + 1);
+                i = j + 1;
+                continue;
+            }
+        }
+        i++;
     }
+}
 
-    input_string = argv[2];
-    //ALL ARGS PROCESSED - The string you are working with is
-    //is the third arg or in arv[2]
-    
-    switch (opt){
-        case 'c':
-            int wc = 0;         //variable for the word count
+//reverse_utf8() - reverses the characters in buf rather than the bytes
+void reverse_utf8(char *buf, size_t len){
+    reverse_buf(buf, len);
+    utf8_fix_sequences(buf, len);
+}
 
-            //TODO: #2. Call count_words, return of the result
-            //          should go into the wc variable
-            wc = count_words(input_string); //calling count_words 
-            printf("Word Count: %d\n", wc);
-            break;
-        case 'r':
-            //TODO: #3. Call reverse string using input_string
-            //          input string should be reversed
-            reverse_string(input_string);   //calling input_string
-            printf("Reversed string: %s\n", input_string);
+//word_print_utf8_buf() - word_print_buf() for utf-8 text, wlen is the
+//word length in characters
+void word_print_utf8_buf(const char *buf, size_t len, word_print_state_t *st){
+    const unsigned char *s = (const unsigned char *)buf;
+    size_t word = 0;    //where the part of the word in buf starts
+    size_t i = 0;
 
-            //TODO:  #4.  The algorithm provided in the directions 
-            //            state we simply return after swapping all 
-            //            characters because the string is reversed 
-            //            in place.  Briefly explain why the string 
-            //            is reversed in place - place in a comment
-            //ANSWER:
-                    //The string is reversed in place because the reverse_string() function directly modifies the 
-                    //original input_string array. It swaps characters within the existing memory allocated for the 
-                    //string; it doesn't create a new string. Therefore, when the function returns, the original 
-                    //input_string has been modified, and no further action is needed to "return" the reversed string.
-            break;
-        case 'w':
-            printf("Word Print\n----------\n");
+    while (i < len) {
+        unsigned int cp;
+        size_t n = utf8_decode(s + i, len - i, &cp);
 
-            //TODO: #5. Call word_print, output should be
-            //          printed by that function
-            word_print(input_string); //calling word_print
+        if (is_utf8_space(cp)) {
+            if (st->word_start) {
+                out_put(buf + word, i - word);
+                out_word_end(st);
+            }
+        } else {
+            if (!st->word_start) {
+                out_word_start(st);
+                word = i;
+            }
+            st->wlen++;
+        }
+        i += n;
+    }
+    if (st->word_start)
+        out_put(buf + word, len - word);
+}
+
+//open_input() - opens path for reading, "-" means stdin
+int open_input(const char *path){
+    if (strcmp(path, "-") == 0)
+        return STDIN_FILENO;
+    return open(path, O_RDONLY);
+}
+
+//read_chunk() - reads until buf is full or the input ends, so a pipe that
+//hands over a few bytes at a time still fills whole chunks.  Returns the
+//number of bytes read (0 at the end of the input) or -1 on an error.
+ssize_t read_chunk(int fd, char *buf, size_t size){
+    size_t got = 0;
+
+    while (got < size) {
+        ssize_t n = read(fd, buf + got, size - got);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
             break;
+        got += n;
+    }
+    return got;
+}
+
+//MEMORY MAPPED INPUT
+//
+//Reading a file through read() copies every byte from the page cache into
+//our buffer before the kernels look at it.  A regular file is mapped
+//instead and the kernels run straight on the page cache, with no copy.
+//Pipes, terminals and empty files can't be mapped and take the read()
+//path as before.
+
+static bool use_mmap = true;    //false when NO_MMAP_ENV is set
+
+//map_input() - maps the whole of fd read only and fills in *m.  Returns -1
+//when fd can't be mapped, and the caller reads it instead.
+int map_input(int fd, mapping_t *m){
+    struct stat sb;
+    off_t off;
+
+    if (!use_mmap || fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+        return -1;
+    off = lseek(fd, 0, SEEK_CUR);
+    if (off < 0 || off > sb.st_size)
+        return -1;
+
+    m->size = sb.st_size;
+    m->base = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m->base == MAP_FAILED)
+        return -1;
+
+    //the kernels read front to back, so ask for big readahead and for the
+    //pages behind us to be dropped early; huge pages where the file
+    //system has them cut the TLB misses on big files
+    madvise(m->base, m->size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(m->base, m->size, MADV_HUGEPAGE);
+#endif
+    m->data = (const char *)m->base + off;
+    m->len = m->size - off;
+    return 0;
+}
+
+void unmap_input(mapping_t *m){
+    munmap(m->base, m->size);
+}
+
+//stream_count_words() - count_words() over everything left in fd.  The
+//in_word flag goes from one chunk to the next, so a word cut in two by a
+//chunk edge is still counted once.  In utf-8 mode a character cut in two
+//is held back and finished with the next chunk.
+int stream_count_words(int fd, bool utf8, size_t *wc){
+    static char buf[CHUNK_SIZE + 3];
+
+    return count_fd(fd, buf, utf8, wc);
+}
+
+//count_fd() - stream_count_words() with the caller's buffer, which must
+//hold CHUNK_SIZE + 3 bytes, so that threads can each have their own
+int count_fd(int fd, char *buf, bool utf8, size_t *wc){
+    bool in_word = false;
+    size_t carry = 0;
+    mapping_t m;
+    ssize_t n;
+
+    *wc = 0;
+    if (map_input(fd, &m) == 0) {
+        if (utf8)
+            *wc = count_words_utf8(m.data, m.len, &in_word);
+        else
+            *wc = count_words_buf(m.data, m.len, &in_word);
+        unmap_input(&m);
+        return 0;
+    }
+
+    while ((n = read_chunk(fd, buf + carry, CHUNK_SIZE)) > 0) {
+        size_t len = carry + n;
+
+        if (!utf8) {
+            *wc += count_words_buf(buf, len, &in_word);
+            continue;
+        }
+        carry = utf8_tail_len(buf, len);
+        *wc += count_words_utf8(buf, len - carry, &in_word);
+        memmove(buf, buf + len - carry, carry);
+    }
+    *wc += count_words_utf8(buf, carry, &in_word);
+    return n < 0 ? -1 : 0;
+}
+
+//stream_word_print() - word_print() over everything left in fd, chunk
+//edges are handled the same way as stream_count_words()
+int stream_word_print(int fd, bool utf8){
+    static char buf[CHUNK_SIZE + 3];
+    word_print_state_t st = {0, 0, false};
+    size_t carry = 0;
+    mapping_t m;
+    ssize_t n;
+
+    if (map_input(fd, &m) == 0) {
+        if (utf8)
+            word_print_utf8_buf(m.data, m.len, &st);
+        else
+            word_print_buf(m.data, m.len, &st);
+        word_print_end(&st);
+        unmap_input(&m);
+        return 0;
+    }
+
+    while ((n = read_chunk(fd, buf + carry, CHUNK_SIZE)) > 0) {
+        size_t len = carry + n;
+
+        if (!utf8) {
+            word_print_buf(buf, len, &st);
+            continue;
+        }
+        carry = utf8_tail_len(buf, len);
+        word_print_utf8_buf(buf, len - carry, &st);
+        memmove(buf, buf + len - carry, carry);
+    }
+    word_print_utf8_buf(buf, carry, &st);
+    word_print_end(&st);
+    return n < 0 ? -1 : 0;
+}
+
+//pread_full() / pwrite_full() - read or write exactly len bytes at off,
+//retrying short transfers.  Return 0, or -1 on an error or early EOF.
+static int pread_full(int fd, char *buf, size_t len, off_t off){
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const char *buf, size_t len, off_t off){
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+//seekable_input() - fd itself if it is a regular file.  Otherwise (a pipe
+//or a terminal) everything in it is copied to a temporary file, *spool,
+//and that is returned instead, so it can be read backwards.  The caller
+//closes *spool.  Returns -1 on an error.
+static int seekable_input(int fd, FILE **spool){
+    static char buf[CHUNK_SIZE];
+    struct stat sb;
+    ssize_t n;
+
+    *spool = NULL;
+    if (fstat(fd, &sb) < 0)
+        return -1;
+    if (S_ISREG(sb.st_mode))
+        return fd;
+
+    *spool = tmpfile();
+    if (*spool == NULL)
+        return -1;
+    while ((n = read_chunk(fd, buf, sizeof(buf))) > 0) {
+        if (fwrite(buf, 1, n, *spool) != (size_t)n) {
+            n = -1;
+            break;
+        }
+    }
+    if (n < 0 || fflush(*spool) != 0) {
+        fclose(*spool);
+        *spool = NULL;
+        return -1;
+    }
+    return fileno(*spool);
+}
+
+//reverse_backwards() - prints the whole of the seekable file fd reversed.
+//The last chunk of the input is the first chunk of the output, so chunks
+//are read from the end of the file backwards and each one is reversed on
+//its own.  In utf-8 mode a chunk that starts partway through a character
+//gives those bytes back to the chunk before it, so characters are never
+//split.
+static int reverse_backwards(int fd, bool utf8){
+    static char buf[CHUNK_SIZE];
+    off_t pos;
+    ssize_t n;
+    int rc = 0;
+
+    pos = lseek(fd, 0, SEEK_END);
+    if (pos < 0)
+        rc = -1;
+
+    printf("Reversed string: ");
+    while (rc == 0 && pos > 0) {
+        size_t len = pos < CHUNK_SIZE ? (size_t)pos : CHUNK_SIZE;
+
+        pos -= len;
+        n = pread(fd, buf, len, pos);
+        if (n < 0 && errno == EINTR) {
+            pos += len;
+            continue;
+        }
+        if (n != (ssize_t)len) {
+            rc = -1;
+            break;
+        }
+        if (utf8) {
+            size_t skip = 0;
+
+            while (pos > 0 && skip < 3 && skip < len && IS_UTF8_CONT(buf[skip]))
+                skip++;
+            pos += skip;
+            reverse_utf8(buf + skip, len - skip);
+            fwrite(buf + skip, 1, len - skip, stdout);
+            continue;
+        }
+        reverse_buf(buf, len);
+        fwrite(buf, 1, len, stdout);
+    }
+    printf("\n");
+    return rc;
+}
+
+//stream_reverse() - prints everything in fd reversed.  A pipe can't be
+//read backwards, so it is copied into a temporary file first; that keeps
+//memory use to one chunk no matter how big the input is.
+int stream_reverse(int fd, bool utf8){
+    FILE *spool = NULL;
+    int rc;
+
+    fd = seekable_input(fd, &spool);
+    if (fd < 0)
+        return -1;
+    rc = reverse_backwards(fd, utf8);
+    if (spool != NULL)
+        fclose(spool);
+    return rc;
+}
+
+//WORD ORDER REVERSE (-R)
+//
+//"a b c" becomes "c b a".  Reversing the whole buffer puts the words in
+//the right order but spells each one backwards, so then each word is
+//reversed again on its own.  Both steps are in place and use the same
+//reverse kernels as -r, so no extra memory is needed however long the
+//line is.  Separators are left where the first reverse put them.  With
+//-u the words are copied out whole in reverse order instead, the way
+//stream_reverse_words() writes them, since invalid utf-8 does not come
+//back byte for byte from reversing it twice.
+
+//utf8_char_len() - the length of the character at buf[i], and in *sep
+//whether it is whitespace
+static inline size_t utf8_char_len(const char *buf, size_t i, size_t len, bool *sep){
+    unsigned int cp;
+    size_t n = utf8_decode((const unsigned char *)buf + i, len - i, &cp);
+
+    *sep = is_utf8_space(cp);
+    return n;
+}
+
+//utf8_prev_char() - the length of the character that ends at buf[i - 1],
+//looking back no further than buf[lo], and in *sep whether it is
+//whitespace.  Bytes that do not end a whole character go one at a time.
+static inline size_t utf8_prev_char(const char *buf, size_t lo, size_t i, size_t len,
+                                    bool *sep){
+    size_t n = 1;
+
+    while (i - n > lo && IS_UTF8_CONT(buf[i - n]) && n < 4)
+        n++;
+    if (utf8_char_len(buf, i - n, len, sep) != n) {
+        n = 1;
+        utf8_char_len(buf, i - 1, len, sep);
+    }
+    return n;
+}
+
+//reverse_words() - reverses the order of the words in buf in place,
+//returns -1 if it runs out of memory
+int reverse_words(char *buf, size_t len, bool utf8){
+    size_t i = 0;
+
+    if (!utf8) {
+        reverse_buf(buf, len);
+        while (i < len) {
+            const char *end;
+            size_t stop;
+
+            if (IS_SEP(buf[i])) {
+                i++;
+                continue;
+            }
+            end = find_sep(buf + i, len - i);
+            stop = end != NULL ? (size_t)(end - buf) : len;
+            reverse_buf(buf + i, stop - i);
+            i = stop;
+        }
+        return 0;
+    }
+
+    //in utf-8 mode the words and separators are scanned from the end of a
+    //copy and written back to buf front to back, as they are found
+    char *src = malloc(len ? len : 1);
+    char *out = buf;
+    bool in_word = false;
+    size_t word_end = 0;
+
+    if (src == NULL)
+        return -1;
+    memcpy(src, buf, len);
+
+    i = len;
+    while (i > 0) {
+        bool sep;
+        size_t n = utf8_prev_char(src, 0, i, len, &sep);
+
+        if (sep && in_word) {
+            memcpy(out, src + i, word_end - i);
+            out += word_end - i;
+            in_word = false;
+        }
+        if (sep) {
+            memcpy(out, src + i - n, n);
+            out += n;
+        } else if (!in_word) {
+            in_word = true;
+            word_end = i;
+        }
+        i -= n;
+    }
+    if (in_word)
+        memcpy(out, src, word_end);
+    free(src);
+    return 0;
+}
+
+//emit_range() - writes bytes [from, to) of fd to the output, a chunk at a
+//time, for a word too long to still be in the buffer
+static int emit_range(int fd, off_t from, off_t to){
+    static char piece[CHUNK_SIZE];
+
+    while (from < to) {
+        size_t len = to - from < CHUNK_SIZE ? (size_t)(to - from) : CHUNK_SIZE;
+
+        if (pread_full(fd, piece, len, from) < 0)
+            return -1;
+        out_put(piece, len);
+        from += len;
+    }
+    return 0;
+}
+
+//stream_reverse_words() - reverse_words() for a file or pipe.  The file
+//is read backwards a chunk at a time, the way reverse_backwards() does,
+//and scanned from the end.  Every separator is written out as soon as it
+//is reached, and so is every word, once its first byte is found: from
+//the buffer if it is all still there, or else read again from the file,
+//front to back, by emit_range().  Only the offset where the current word
+//ends is carried from chunk to chunk, so even a word bigger than memory
+//comes out right.  Pipes are saved to a temporary file first.
+int stream_reverse_words(int fd, bool utf8){
+    static char buf[CHUNK_SIZE];
+    FILE *spool = NULL;
+    off_t word_end = -1;    //where the word being scanned ends, -1 = none
+    off_t pos;
+    int rc = 0;
+
+    fd = seekable_input(fd, &spool);
+    if (fd < 0)
+        return -1;
+
+    pos = lseek(fd, 0, SEEK_END);
+    if (pos < 0)
+        rc = -1;
+
+    printf("Reversed words: ");
+    while (rc == 0 && pos > 0) {
+        size_t len = pos < CHUNK_SIZE ? (size_t)pos : CHUNK_SIZE;
+        off_t start = pos - len;
+        size_t skip = 0;
+        size_t i;
+
+        if (pread_full(fd, buf, len, start) < 0) {
+            rc = -1;
+            break;
+        }
+        //as in reverse_backwards(), characters are never split
+        while (utf8 && start > 0 && skip < 3 && skip < len && IS_UTF8_CONT(buf[skip]))
+            skip++;
+
+        i = len;
+        while (i > skip) {
+            size_t n = 1;
+            bool sep;
+
+            if (utf8) {
+                n = utf8_prev_char(buf, skip, i, len, &sep);
+            } else {
+                sep = IS_SEP(buf[i - 1]);
+            }
+
+            if (sep && word_end >= 0) {
+                off_t word_start = start + i;
+
+                if (word_end <= pos)
+                    out_put(buf + i, word_end - word_start);
+                else if (emit_range(fd, word_start, word_end) < 0)
+                    rc = -1;
+                word_end = -1;
+            }
+            if (sep)
+                out_put(buf + i - n, n);
+            else if (word_end < 0)
+                word_end = start + i;
+            i -= n;
+        }
+        pos = start + skip;
+    }
+    if (rc == 0 && word_end >= 0)
+        rc = emit_range(fd, 0, word_end);
+    out_put("\n", 1);
+    if (out_flush() < 0)
+        rc = -1;
+
+    if (spool != NULL)
+        fclose(spool);
+    return rc;
+}
+
+//reverse_file() - reverses the file at path in place (-r -i file
+//--in-place).  It is reverse_buf() one level up: a chunk is read from each
+//end of the file, each chunk is reversed, and they are written back in
+//each other's place.  Once less than two chunks are left in the middle
+//they are read together, reversed and written back.  Memory use is two
+//chunks whatever the size of the file.
+int reverse_file(const char *path){
+    static char front[CHUNK_SIZE];
+    static char back[CHUNK_SIZE * 2];
+    struct stat sb;
+    off_t lo, hi;
+    int fd;
+    int rc = 0;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    lo = 0;
+    hi = sb.st_size;
+    while (rc == 0 && hi - lo >= (off_t)CHUNK_SIZE * 2) {
+        if (pread_full(fd, front, CHUNK_SIZE, lo) < 0 ||
+            pread_full(fd, back, CHUNK_SIZE, hi - CHUNK_SIZE) < 0) {
+            rc = -1;
+            break;
+        }
+        reverse_buf(front, CHUNK_SIZE);
+        reverse_buf(back, CHUNK_SIZE);
+        if (pwrite_full(fd, back, CHUNK_SIZE, lo) < 0 ||
+            pwrite_full(fd, front, CHUNK_SIZE, hi - CHUNK_SIZE) < 0)
+            rc = -1;
+        lo += CHUNK_SIZE;
+        hi -= CHUNK_SIZE;
+    }
+
+    if (rc == 0 && hi > lo) {
+        if (pread_full(fd, back, hi - lo, lo) < 0)
+            rc = -1;
+        else {
+            reverse_buf(back, hi - lo);
+            rc = pwrite_full(fd, back, hi - lo, lo);
+        }
+    }
+
+    if (close(fd) < 0)
+        rc = -1;
+    return rc;
+}
+
+//one thread's share of parallel_count_words(): the byte range
+//[start, end) of the file, and what it found there.  first_in_word and
+//last_in_word say whether the first and last bytes of the range are part
+//of a word, which is all that is needed to join the ranges back up.
+typedef struct count_range {
+    int fd;
+    const char *map;    //the whole file when it is mapped, else NULL
+    off_t start;
+    off_t end;
+    size_t wc;
+    bool first_in_word;
+    bool last_in_word;
+    int rc;
+} count_range_t;
+
+static void *count_range_worker(void *arg){
+    count_range_t *r = arg;
+    char *buf;
+    bool in_word = false;   //every range is counted as if it starts a file
+    off_t pos = r->start;
+
+    if (r->map != NULL) {
+        r->first_in_word = !IS_SEP(r->map[r->start]);
+        r->wc = count_words_buf(r->map + r->start, r->end - r->start, &in_word);
+        r->last_in_word = in_word;
+        r->rc = 0;
+        return NULL;
+    }
+
+    buf = malloc(CHUNK_SIZE);
+    r->rc = -1;
+    if (buf == NULL)
+        return NULL;
+
+    while (pos < r->end) {
+        size_t len = r->end - pos < CHUNK_SIZE ? (size_t)(r->end - pos) : CHUNK_SIZE;
+        ssize_t n = pread(r->fd, buf, len, pos);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (pos == r->start)
+            r->first_in_word = !IS_SEP(buf[0]);
+        r->wc += count_words_buf(buf, n, &in_word);
+        pos += n;
+    }
+
+    r->last_in_word = in_word;
+    if (pos == r->end)
+        r->rc = 0;
+    free(buf);
+    return NULL;
+}
+
+//parallel_count_words() - counts the words in a regular file with up to
+//threads threads (0 = one per online cpu).  The file is cut into one byte
+//range per thread and each range is counted on its own with pread(), as
+//if it were the start of a file.  A word that straddles a cut is then
+//counted twice, once at the end of one range and again at the start of
+//the next, so for every cut where the range before ends inside a word and
+//the range after starts inside one, one is taken off the total.  When
+//the file can be mapped the threads count straight from the mapping.  The
+//result is always the same as the serial count.  Anything that is not a
+//regular file, or is too small to be worth splitting, is counted by
+//stream_count_words() instead, and so is utf-8 mode, where a cut could
+//land in the middle of a character.
+int parallel_count_words(int fd, int threads, size_t *wc){
+    count_range_t ranges[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    bool started[MAX_THREADS];
+    mapping_t m;
+    bool mapped;
+    struct stat sb;
+    off_t per;
+    int rc = 0;
+    int n;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    if (threads <= 1 || fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) ||
+        sb.st_size < (off_t)CHUNK_SIZE * 2)
+        return stream_count_words(fd, false, wc);
+
+    mapped = lseek(fd, 0, SEEK_SET) == 0 && map_input(fd, &m) == 0;
+
+    //whole chunks per range, so every pread() but the last is full size;
+    //the share is rounded up first so threads ranges always reach EOF
+    per = (sb.st_size + threads - 1) / threads;
+    per = (per + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+    n = 0;
+    for (off_t start = 0; start < sb.st_size && n < threads; start += per, n++) {
+        ranges[n] = (count_range_t){ .fd = fd, .start = start,
+            .map = mapped ? m.base : NULL,
+            .end = start + per < sb.st_size ? start + per : sb.st_size };
+        started[n] = pthread_create(&tids[n], NULL, count_range_worker, &ranges[n]) == 0;
+        if (!started[n])
+            count_range_worker(&ranges[n]);
+    }
+
+    *wc = 0;
+    for (int i = 0; i < n; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        if (ranges[i].rc < 0)
+            rc = -1;
+        *wc += ranges[i].wc;
+        if (i > 0 && ranges[i - 1].last_in_word && ranges[i].first_in_word)
+            (*wc)--;
+    }
+    if (mapped)
+        unmap_input(&m);
+    return rc;
+}
+
+//WORD FREQUENCY (-f)
+//
+//Counts how many times each word appears and prints the most frequent
+//ones, the same as tr ' ' '\n' | sort | uniq -c | sort -rn | head, but in
+//one pass and without sorting every word.
+
+static void *arena_alloc(arena_t *a, size_t n){
+    arena_block_t *b = a->head;
+
+    if (b == NULL || b->cap - b->used < n) {
+        size_t cap = n > ARENA_BLOCK_SIZE ? n : ARENA_BLOCK_SIZE;
+
+        b = malloc(sizeof(*b) + cap);
+        if (b == NULL)
+            return NULL;
+        b->next = a->head;
+        b->used = 0;
+        b->cap = cap;
+        a->head = b;
+    }
+    b->used += n;
+    return b->data + b->used - n;
+}
+
+static void arena_free(arena_t *a){
+    while (a->head != NULL) {
+        arena_block_t *next = a->head->next;
+
+        free(a->head);
+        a->head = next;
+    }
+}
+
+//fnv-1a, good enough for words and cheap to compute
+static uint64_t freq_hash(const char *word, size_t len){
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)word[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int freq_init(freq_table_t *t){
+    memset(t, 0, sizeof(*t));
+    t->cap = 1024;
+    t->slots = calloc(t->cap, sizeof(freq_entry_t));
+    return t->slots == NULL ? -1 : 0;
+}
+
+void freq_free(freq_table_t *t){
+    free(t->slots);
+    free(t->pending);
+    arena_free(&t->arena);
+    memset(t, 0, sizeof(*t));
+}
+
+//freq_slot() - the slot that holds word, or the empty slot it would go in
+static freq_entry_t *freq_slot(freq_entry_t *slots, size_t cap, const char *word,
+                               size_t len, uint64_t hash){
+    size_t i = hash & (cap - 1);
+
+    while (slots[i].word != NULL) {
+        if (slots[i].hash == hash && slots[i].len == len &&
+            memcmp(slots[i].word, word, len) == 0)
+            break;
+        i = (i + 1) & (cap - 1);
+    }
+    return &slots[i];
+}
+
+static int freq_grow(freq_table_t *t){
+    size_t cap = t->cap * 2;
+    freq_entry_t *slots = calloc(cap, sizeof(freq_entry_t));
+
+    if (slots == NULL)
+        return -1;
+    for (size_t i = 0; i < t->cap; i++) {
+        freq_entry_t *e = &t->slots[i];
+
+        if (e->word != NULL)
+            *freq_slot(slots, cap, e->word, e->len, e->hash) = *e;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->cap = cap;
+    return 0;
+}
+
+//freq_add() - adds count to word's count, copying word into the arena the
+//first time it is seen
+int freq_add(freq_table_t *t, const char *word, size_t len, size_t count){
+    uint64_t hash = freq_hash(word, len);
+    freq_entry_t *e = freq_slot(t->slots, t->cap, word, len, hash);
+
+    if (e->word == NULL) {
+        char *copy;
+
+        if ((t->used + 1) * 4 > t->cap * 3) {
+            if (freq_grow(t) < 0)
+                return -1;
+            e = freq_slot(t->slots, t->cap, word, len, hash);
+        }
+        copy = arena_alloc(&t->arena, len);
+        if (copy == NULL)
+            return -1;
+        memcpy(copy, word, len);
+        *e = (freq_entry_t){ copy, len, hash, 0 };
+        t->used++;
+    }
+    e->count += count;
+    return 0;
+}
+
+static int freq_pending_append(freq_table_t *t, const char *buf, size_t len){
+    if (t->pending_len + len > t->pending_cap) {
+        size_t cap = (t->pending_len + len) * 2;
+        char *p = realloc(t->pending, cap);
+
+        if (p == NULL)
+            return -1;
+        t->pending = p;
+        t->pending_cap = cap;
+    }
+    memcpy(t->pending + t->pending_len, buf, len);
+    t->pending_len += len;
+    return 0;
+}
+
+//freq_finish() - adds the word left in pending once the input has ended
+int freq_finish(freq_table_t *t){
+    int rc = 0;
+
+    if (t->pending_len > 0)
+        rc = freq_add(t, t->pending, t->pending_len, 1);
+    t->pending_len = 0;
+    return rc;
+}
+
+//freq_char() - the length in bytes of the character at buf[i], and in
+//*sep whether it separates words
+static inline size_t freq_char(const char *buf, size_t i, size_t len, bool utf8,
+                               bool *sep){
+    unsigned int cp;
+    size_t n;
+
+    if (!utf8) {
+        *sep = IS_SEP(buf[i]);
+        return 1;
+    }
+    n = utf8_decode((const unsigned char *)buf + i, len - i, &cp);
+    *sep = is_utf8_space(cp);
+    return n;
+}
+
+//freq_add_buf() - adds every word in buf to the table.  The buffer can be
+//one chunk of a bigger input: a word that runs into the end of buf is
+//kept in pending and finished by the next call, or by freq_finish().
+int freq_add_buf(freq_table_t *t, const char *buf, size_t len, bool utf8){
+    size_t i = 0;
+
+    while (i < len) {
+        size_t start = i;
+        bool sep;
+        size_t n = freq_char(buf, i, len, utf8, &sep);
+
+        if (sep) {
+            if (freq_finish(t) < 0)
+                return -1;
+            i += n;
+            continue;
+        }
+
+        while (i < len) {
+            n = freq_char(buf, i, len, utf8, &sep);
+            if (sep)
+                break;
+            i += n;
+        }
+
+        if (i == len)
+            return freq_pending_append(t, buf + start, i - start);
+        if (t->pending_len > 0) {
+            if (freq_pending_append(t, buf + start, i - start) < 0 ||
+                freq_finish(t) < 0)
+                return -1;
+        } else if (freq_add(t, buf + start, i - start, 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//freq_merge() - adds every count in src to dst, so partial tables built
+//by separate threads can be combined into one
+int freq_merge(freq_table_t *dst, const freq_table_t *src){
+    for (size_t i = 0; i < src->cap; i++) {
+        const freq_entry_t *e = &src->slots[i];
+
+        if (e->word != NULL && freq_add(dst, e->word, e->len, e->count) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int freq_cmp_word(const freq_entry_t *a, const freq_entry_t *b){
+    int c = memcmp(a->word, b->word, a->len < b->len ? a->len : b->len);
+
+    if (c != 0)
+        return c;
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+//most frequent first, ties in word order so the output is always the same
+static int freq_cmp_count(const void *pa, const void *pb){
+    const freq_entry_t *a = *(freq_entry_t * const *)pa;
+    const freq_entry_t *b = *(freq_entry_t * const *)pb;
+
+    if (a->count != b->count)
+        return a->count < b->count ? 1 : -1;
+    return freq_cmp_word(a, b);
+}
+
+static int freq_cmp_key(const void *pa, const void *pb){
+    return freq_cmp_word(*(freq_entry_t * const *)pa, *(freq_entry_t * const *)pb);
+}
+
+//freq_print() - prints the top words by count, or every word in byte
+//order with by_key.  top limits how many are printed (0 = all, -1 = the
+//default for the order).
+int freq_print(const freq_table_t *t, long top, bool by_key){
+    freq_entry_t **order = malloc((t->used ? t->used : 1) * sizeof(*order));
+    size_t n = 0;
+
+    if (order == NULL)
+        return -1;
+    for (size_t i = 0; i < t->cap; i++)
+        if (t->slots[i].word != NULL)
+            order[n++] = &t->slots[i];
+    qsort(order, n, sizeof(*order), by_key ? freq_cmp_key : freq_cmp_count);
+
+    if (top < 0)
+        top = by_key ? 0 : FREQ_DEFAULT_TOP;
+    if (top > 0 && (size_t)top < n)
+        n = top;
+
+    printf("Word Frequency\n--------------\n");
+    for (size_t i = 0; i < n; i++) {
+        printf("%7zu ", order[i]->count);
+        fwrite(order[i]->word, 1, order[i]->len, stdout);
+        putchar('\n');
+    }
+    free(order);
+    return 0;
+}
+
+//stream_freq() - freq_add_buf() over everything left in fd, with utf-8
+//characters cut by a chunk edge held back like stream_count_words()
+int stream_freq(int fd, bool utf8, freq_table_t *t){
+    static char buf[CHUNK_SIZE + 3];
+    size_t carry = 0;
+    mapping_t m;
+    ssize_t n;
+
+    if (map_input(fd, &m) == 0) {
+        int rc = freq_add_buf(t, m.data, m.len, utf8);
+
+        unmap_input(&m);
+        return rc < 0 ? -1 : freq_finish(t);
+    }
+
+    while ((n = read_chunk(fd, buf + carry, CHUNK_SIZE)) > 0) {
+        size_t len = carry + n;
+
+        carry = utf8 ? utf8_tail_len(buf, len) : 0;
+        if (freq_add_buf(t, buf, len - carry, utf8) < 0)
+            return -1;
+        memmove(buf, buf + len - carry, carry);
+    }
+    if (n < 0 || freq_add_buf(t, buf, carry, utf8) < 0)
+        return -1;
+    return freq_finish(t);
+}
+
+//one thread's share of parallel_freq().  A range owns every word that
+//starts inside it: a word already running at the start of the range is
+//skipped, and the last word is followed past the end of the range until
+//it ends.
+typedef struct freq_range {
+    int fd;
+    const char *map;    //the whole file when it is mapped, else NULL
+    off_t start;
+    off_t end;
+    off_t size;
+    freq_table_t table;
+    int rc;
+} freq_range_t;
+
+static void *freq_range_worker(void *arg){
+    freq_range_t *r = arg;
+    char *buf;
+    bool skip = false;
+    off_t pos = r->start;
+
+    r->rc = -1;
+    if (r->map != NULL) {
+        off_t from = r->start;
+        off_t to = r->end;
+
+        if (from > 0 && !IS_SEP(r->map[from - 1]))
+            while (from < to && !IS_SEP(r->map[from]))
+                from++;
+        if (from < to) {
+            //finish a word that runs over the end; one that starts right at
+            //the end belongs to the next range
+            if (!IS_SEP(r->map[to - 1]))
+                while (to < r->size && !IS_SEP(r->map[to]))
+                    to++;
+            if (freq_add_buf(&r->table, r->map + from, to - from, false) < 0)
+                return NULL;
+        }
+        if (freq_finish(&r->table) == 0)
+            r->rc = 0;
+        return NULL;
+    }
+
+    buf = malloc(CHUNK_SIZE);
+    if (buf == NULL)
+        return NULL;
+
+    if (pos > 0) {
+        char before;
+
+        if (pread_full(r->fd, &before, 1, pos - 1) < 0)
+            goto out;
+        skip = !IS_SEP(before);
+    }
+
+    while (pos < r->end) {
+        size_t len = r->end - pos < CHUNK_SIZE ? (size_t)(r->end - pos) : CHUNK_SIZE;
+        size_t from = 0;
+
+        if (pread_full(r->fd, buf, len, pos) < 0)
+            goto out;
+        while (skip && from < len) {
+            if (IS_SEP(buf[from]))
+                skip = false;
+            else
+                from++;
+        }
+        if (freq_add_buf(&r->table, buf + from, len - from, false) < 0)
+            goto out;
+        pos += len;
+    }
+
+    while (r->table.pending_len > 0 && pos < r->size) {
+        size_t len = r->size - pos < CHUNK_SIZE ? (size_t)(r->size - pos) : CHUNK_SIZE;
+        size_t word = 0;
+
+        if (pread_full(r->fd, buf, len, pos) < 0)
+            goto out;
+        while (word < len && !IS_SEP(buf[word]))
+            word++;
+        if (freq_add_buf(&r->table, buf, word, false) < 0)
+            goto out;
+        if (word < len)
+            break;
+        pos += len;
+    }
+
+    if (freq_finish(&r->table) == 0)
+        r->rc = 0;
+out:
+    free(buf);
+    return NULL;
+}
+
+//parallel_freq() - the -j version of stream_freq().  Each thread builds
+//its own table for its byte range and the tables are merged into t at
+//the end.  Falls back to stream_freq() in the same cases as
+//parallel_count_words().
+int parallel_freq(int fd, int threads, freq_table_t *t){
+    freq_range_t ranges[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    bool started[MAX_THREADS];
+    mapping_t m;
+    bool mapped;
+    struct stat sb;
+    off_t per;
+    int rc = 0;
+    int n;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    if (threads <= 1 || fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) ||
+        sb.st_size < (off_t)CHUNK_SIZE * 2)
+        return stream_freq(fd, false, t);
+
+    mapped = lseek(fd, 0, SEEK_SET) == 0 && map_input(fd, &m) == 0;
+
+    //rounded up like parallel_count_words() so the last range reaches EOF
+    per = (sb.st_size + threads - 1) / threads;
+    per = (per + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+    n = 0;
+    for (off_t start = 0; start < sb.st_size && n < threads; start += per, n++) {
+        ranges[n] = (freq_range_t){ .fd = fd, .start = start, .size = sb.st_size,
+            .map = mapped ? m.base : NULL,
+            .end = start + per < sb.st_size ? start + per : sb.st_size };
+        if (freq_init(&ranges[n].table) < 0) {
+            started[n] = false;
+            ranges[n].rc = -1;
+            continue;
+        }
+        started[n] = pthread_create(&tids[n], NULL, freq_range_worker, &ranges[n]) == 0;
+        if (!started[n])
+            freq_range_worker(&ranges[n]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        if (ranges[i].rc < 0 || freq_merge(t, &ranges[i].table) < 0)
+            rc = -1;
+        freq_free(&ranges[i].table);
+    }
+    if (mapped)
+        unmap_input(&m);
+    return rc;
+}
+
+//SEARCH AND REPLACE (-x)
+//
+//Every match of find is replaced, left to right, and matches don't
+//overlap, the same as sed 's/find/replace/g' on plain text.
+
+void matcher_init(matcher_t *m, const char *needle, size_t len){
+    m->needle = needle;
+    m->len = len;
+    if (len < BMH_MIN_LEN)
+        return;
+    for (int c = 0; c < 256; c++)
+        m->skip[c] = len;
+    for (size_t i = 0; i + 1 < len; i++)
+        m->skip[(unsigned char)needle[i]] = len - 1 - i;
+}
+
+//find_scalar() - memchr() for the first byte, then compare the rest
+static const char *find_scalar(const matcher_t *m, const char *hay, size_t len){
+    const char *end = hay + len;
+
+    while ((size_t)(end - hay) >= m->len) {
+        const char *p = memchr(hay, m->needle[0], end - hay - m->len + 1);
+
+        if (p == NULL)
+            return NULL;
+        if (memcmp(p + 1, m->needle + 1, m->len - 1) == 0)
+            return p;
+        hay = p + 1;
+    }
+    return NULL;
+}
+
+//find_bmh() - boyer-moore-horspool: compare the last byte of the window
+//first and on a miss shift by how far that byte is from the end of the
+//pattern.  Long patterns move many bytes per step.
+static const char *find_bmh(const matcher_t *m, const char *hay, size_t len){
+    const unsigned char *h = (const unsigned char *)hay;
+    size_t last = m->len - 1;
+    size_t i = 0;
+
+    while (i + m->len <= len) {
+        unsigned char c = h[i + last];
+
+        if (c == (unsigned char)m->needle[last] &&
+            memcmp(hay + i, m->needle, last) == 0)
+            return hay + i;
+        i += m->skip[c];
+    }
+    return NULL;
+}
+
+#ifdef HAVE_X86_SIMD
+//simd filter - for 16 (sse2) or 32 (avx2) window positions at once,
+//compare the first byte of each window with the first byte of the pattern
+//and the last byte with the last byte.  Only windows where both match are
+//compared in full, which on normal text is very few of them.
+static const char *find_sse2(const matcher_t *m, const char *hay, size_t len){
+    const __m128i first = _mm_set1_epi8(m->needle[0]);
+    const __m128i last = _mm_set1_epi8(m->needle[m->len - 1]);
+    size_t i = 0;
+
+    for (; i + m->len - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + m->len - 1));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (mask != 0) {
+            size_t at = i + __builtin_ctz(mask);
+
+            if (memcmp(hay + at + 1, m->needle + 1, m->len - 2) == 0)
+                return hay + at;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(m, hay + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const matcher_t *m, const char *hay, size_t len){
+    const __m256i first = _mm256_set1_epi8(m->needle[0]);
+    const __m256i last = _mm256_set1_epi8(m->needle[m->len - 1]);
+    size_t i = 0;
+
+    for (; i + m->len - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + m->len - 1));
+        unsigned int mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        while (mask != 0) {
+            size_t at = i + __builtin_ctz(mask);
+
+            if (memcmp(hay + at + 1, m->needle + 1, m->len - 2) == 0)
+                return hay + at;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(m, hay + i, len - i);
+}
+#endif
+
+//matcher_find() - the first match of m in hay, or NULL
+const char *matcher_find(const matcher_t *m, const char *hay, size_t len){
+    if (m->len > len)
+        return NULL;
+    if (m->len == 1)
+        return memchr(hay, m->needle[0], len);
+    if (m->len >= BMH_MIN_LEN)
+        return find_bmh(m, hay, len);
+#ifdef HAVE_X86_SIMD
+    static int use_avx2 = -1;
+
+    if (use_avx2 < 0) {
+        const char *forced = getenv(KERNEL_ENV);
+
+        if (forced != NULL && strcmp(forced, "scalar") == 0)
+            use_avx2 = 2;
+        else
+            use_avx2 = (forced == NULL || strcmp(forced, "sse2") != 0) &&
+                       __builtin_cpu_supports("avx2");
+    }
+    if (use_avx2 == 1)
+        return find_avx2(m, hay, len);
+    if (use_avx2 == 0)
+        return find_sse2(m, hay, len);
+#endif
+    return find_scalar(m, hay, len);
+}
+
+//replace_buf() - writes buf to the output buffer with every match of m
+//replaced by repl, and adds the number of matches to *count.  Unless this
+//is the last buffer of the input, the last m->len - 1 bytes may be the
+//start of a match that finishes in the next chunk, so they are left
+//alone.  Returns how many bytes of buf were used up; the caller puts the
+//rest in front of the next chunk.
+size_t replace_buf(const matcher_t *m, const char *repl, size_t rlen,
+                   const char *buf, size_t len, bool last, size_t *count){
+    size_t done = 0;
+    const char *hit;
+
+    while ((hit = matcher_find(m, buf + done, len - done)) != NULL) {
+        out_put(buf + done, hit - (buf + done));
+        out_put(repl, rlen);
+        (*count)++;
+        done = hit - buf + m->len;
+    }
+
+    if (!last && len - done >= m->len)
+        len -= m->len - 1;
+    else if (!last)
+        len = done;
+    out_put(buf + done, len - done);
+    return len;
+}
+
+//stream_replace() - replace_buf() over everything left in fd, written
+//straight to stdout
+int stream_replace(int fd, const matcher_t *m, const char *repl, size_t *count){
+    size_t rlen = strlen(repl);
+    size_t carry = 0;
+    mapping_t map;
+    char *buf;
+    ssize_t n;
+
+    *count = 0;
+    if (map_input(fd, &map) == 0) {
+        replace_buf(m, repl, rlen, map.data, map.len, true, count);
+        unmap_input(&map);
+        return out_flush();
+    }
+
+    buf = malloc(CHUNK_SIZE + m->len);
+    if (buf == NULL)
+        return -1;
+
+    while ((n = read_chunk(fd, buf + carry, CHUNK_SIZE)) > 0) {
+        size_t len = carry + n;
+        size_t used = replace_buf(m, repl, rlen, buf, len, false, count);
+
+        carry = len - used;
+        memmove(buf, buf + used, carry);
+    }
+    if (n == 0)
+        replace_buf(m, repl, rlen, buf, carry, true, count);
+
+    free(buf);
+    if (out_flush() < 0)
+        return -1;
+    return n < 0 ? -1 : 0;
+}
+
+//COMBINED OPERATIONS (-cws and so on)
+//
+//Asking for several results at once used to mean running stringfun once
+//per result and reading the input each time.  With more than one letter
+//after the dash every requested result is worked out from the same chunk
+//while it is in memory, so the input is read once.  The word list prints
+//as it goes, then come the count, the stats and the reverse.
+
+//stats_class() - the CLS_* class of every byte, built on first use
+static const unsigned char *stats_class(void){
+    static unsigned char cls[256];
+    static bool built = false;
+
+    if (!built) {
+        for (int c = 0; c < 256; c++) {
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+                cls[c] = CLS_LETTER;
+            else if (c >= '0' && c <= '9')
+                cls[c] = CLS_DIGIT;
+            else if (c == ' ' || (c >= '\t' && c <= '\r'))
+                cls[c] = CLS_SPACE;
+            else if (c > ' ' && c < 0x7F)
+                cls[c] = CLS_PUNCT;
+            else
+                cls[c] = CLS_OTHER;
+        }
+        built = true;
+    }
+    return cls;
+}
+
+static void stats_end_word(text_stats_t *ts){
+    ts->words++;
+    ts->wlen_hist[ts->wlen < STATS_MAX_WLEN ? ts->wlen : STATS_MAX_WLEN]++;
+    ts->wlen = 0;
+    ts->in_word = false;
+}
+
+//stats_buf() - adds buf to the character class counts and the word length
+//histogram.  Words are split on the -S set, as for -c and -w.
+void stats_buf(text_stats_t *ts, const char *buf, size_t len){
+    const unsigned char *cls = stats_class();
+
+    ts->bytes += len;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = buf[i];
+
+        ts->cls[cls[c]]++;
+        if (!IS_SEP(c)) {
+            ts->wlen++;
+            ts->in_word = true;
+        } else if (ts->in_word) {
+            stats_end_word(ts);
+        }
+    }
+}
+
+//stats_print() - finishes the last word and prints the stats
+void stats_print(text_stats_t *ts){
+    static const char *names[CLS_COUNT] = {
+        "Letters", "Digits", "Whitespace", "Punctuation", "Other"
+    };
+
+    if (ts->in_word)
+        stats_end_word(ts);
+
+    printf("Text Stats\n----------\n");
+    printf("Bytes: %zu\n", ts->bytes);
+    printf("Words: %zu\n", ts->words);
+    for (int c = 0; c < CLS_COUNT; c++)
+        printf("%s: %zu\n", names[c], ts->cls[c]);
+    printf("Word Lengths\n------------\n");
+    for (int n = 1; n <= STATS_MAX_WLEN; n++)
+        if (ts->wlen_hist[n] > 0)
+            printf("%d%s: %zu\n", n, n == STATS_MAX_WLEN ? "+" : "", ts->wlen_hist[n]);
+}
+
+//fused_buf() - runs every requested operation over one chunk
+void fused_buf(fused_t *f, const char *buf, size_t len){
+    if (f->count)
+        f->wc += count_words_buf(buf, len, &f->in_word);
+    if (f->print)
+        word_print_buf(buf, len, &f->wp);
+    if (f->stats)
+        stats_buf(&f->ts, buf, len);
+}
+
+//run_fused() - the combined operations in ops over input_string, or over
+//so->path when it is set.  Returns the exit code for main().
+//
+//The reverse comes out last chunk first, the opposite order to the one
+//the input is read in, so for a file it is read back to front from the
+//page cache once the forward pass is done.  A pipe can't be read twice;
+//each chunk is saved to a temporary file as it goes past instead.
+int run_fused(const char *ops, const stream_opts_t *so, char *input_string){
+    static char buf[CHUNK_SIZE];
+    fused_t f;
+    mapping_t m;
+    FILE *spool = NULL;
+    struct stat sb;
+    ssize_t n = 0;
+    int fd = -1;
+    int rc = 0;
+
+    memset(&f, 0, sizeof(f));
+    for (const char *op = ops; *op != '\0'; op++) {
+        switch (*op) {
+            case 'c': f.count = true; break;
+            case 'w': f.print = true; break;
+            case 'r': f.reverse = true; break;
+            case 's': f.stats = true; break;
+            default:
+                printf("Invalid option %c provided, exiting!\n", *op);
+                return 1;
+        }
+    }
+    if (so->utf8 || so->threads != 1 || so->in_place) {
+        printf("Options -u, -j and --in-place don't combine with -%s, exiting!\n", ops);
+        return 1;
+    }
+
+    if (f.print)
+        printf("Word Print\n----------\n");
+
+    if (so->path == NULL) {
+        fused_buf(&f, input_string, strlen(input_string));
+    } else {
+        fd = open_input(so->path);
+        if (fd < 0) {
+            printf("Unable to open %s, exiting!\n", so->path);
+            return 2;
+        }
+        if (map_input(fd, &m) == 0) {
+            //a mapped file is always seekable, so -r needs no spool
+            fused_buf(&f, m.data, m.len);
+            unmap_input(&m);
+        } else {
+            if (f.reverse && (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode))) {
+                spool = tmpfile();
+                if (spool == NULL)
+                    rc = -1;
+            }
+            while (rc == 0 && (n = read_chunk(fd, buf, sizeof(buf))) > 0) {
+                fused_buf(&f, buf, n);
+                if (spool != NULL && fwrite(buf, 1, n, spool) != (size_t)n)
+                    rc = -1;
+            }
+            if (n < 0 || (spool != NULL && fflush(spool) != 0))
+                rc = -1;
+        }
+    }
+
+    if (f.print)
+        word_print_end(&f.wp);
+    if (rc == 0 && f.count)
+        printf("Word Count: %zu\n", f.wc);
+    if (rc == 0 && f.stats)
+        stats_print(&f.ts);
+    if (rc == 0 && f.reverse) {
+        if (so->path == NULL) {
+            reverse_string(input_string);
+            printf("Reversed string: %s\n", input_string);
+        } else {
+            rc = reverse_backwards(spool != NULL ? fileno(spool) : fd, false);
+        }
+    }
+
+    if (spool != NULL)
+        fclose(spool);
+    if (fd >= 0 && fd != STDIN_FILENO)
+        close(fd);
+    if (rc < 0) {
+        printf("Error reading %s, exiting!\n", so->path);
+        return 2;
+    }
+    return 0;
+}
+
+//MANY FILES (-c -i f1 f2 ... / -L)
+//
+//Counting thousands of small files by running stringfun once per file
+//spends most of its time starting processes.  Given more than one file,
+//stringfun counts them all itself with a pool of worker threads.
+//
+//Each worker starts out owning an equal run of the file list, [head,
+//tail), and takes files from the head of its own run.  A worker that runs
+//out steals from the tail of another worker's run, so one slow file
+//doesn't hold up the rest.  Results go into a slot per file and are
+//printed in list order once every worker is done, so the output is the
+//same however the files were shared out.
+
+typedef struct work_queue {
+    pthread_mutex_t lock;
+    size_t head;
+    size_t tail;
+} work_queue_t;
+
+typedef struct file_result {
+    size_t wc;
+    int rc;         //0, or -1 when the file couldn't be opened or read
+} file_result_t;
+
+typedef struct file_pool {
+    const char **paths;
+    size_t npaths;
+    bool utf8;
+    file_result_t *results;
+    work_queue_t *queues;
+    int nworkers;
+} file_pool_t;
+
+typedef struct file_worker {
+    file_pool_t *pool;
+    int id;
+} file_worker_t;
+
+//take_work() - the next file for worker id, its own first, then stolen
+static bool take_work(file_pool_t *pool, int id, size_t *idx){
+    for (int k = 0; k < pool->nworkers; k++) {
+        work_queue_t *q = &pool->queues[(id + k) % pool->nworkers];
+        bool found = false;
+
+        pthread_mutex_lock(&q->lock);
+        if (q->head < q->tail) {
+            *idx = k == 0 ? q->head++ : --q->tail;
+            found = true;
+        }
+        pthread_mutex_unlock(&q->lock);
+        if (found)
+            return true;
+    }
+    return false;
+}
+
+//count_small() - counts a whole buffer that holds an entire file
+static size_t count_small(const char *buf, size_t len, bool utf8){
+    bool in_word = false;
+
+    if (utf8)
+        return count_words_utf8(buf, len, &in_word);
+    return count_words_buf(buf, len, &in_word);
+}
+
+//file_worker_main() - counts files until there are none left anywhere.  A
+//file smaller than the worker's buffer is read with a single read(); for
+//a regular file a short read is the end of the file, so there is no
+//second read() just to see end of file.  Anything bigger is streamed
+//through the same buffer.
+static void *file_worker_main(void *arg){
+    file_worker_t *w = arg;
+    file_pool_t *pool = w->pool;
+    char *buf = malloc(CHUNK_SIZE + 3);
+    size_t idx;
+
+    while (take_work(pool, w->id, &idx)) {
+        file_result_t *r = &pool->results[idx];
+        struct stat sb;
+        int fd;
+
+        r->rc = -1;
+        if (buf == NULL)
+            continue;
+        fd = open(pool->paths[idx], O_RDONLY);
+        if (fd < 0)
+            continue;
+
+        if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size < CHUNK_SIZE) {
+            ssize_t n = read(fd, buf, CHUNK_SIZE);
+
+            if (n >= 0 && n < CHUNK_SIZE) {
+                r->wc = count_small(buf, n, pool->utf8);
+                r->rc = 0;
+            } else if (n >= 0 && lseek(fd, 0, SEEK_SET) == 0) {
+                r->rc = count_fd(fd, buf, pool->utf8, &r->wc);
+            }
+        } else {
+            r->rc = count_fd(fd, buf, pool->utf8, &r->wc);
+        }
+        close(fd);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+//read_path_list() - adds one path per line of stdin to *paths
+static int read_path_list(const char ***paths, size_t *n, size_t *cap){
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &linecap, stdin)) > 0) {
+        if (line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        if (*n == *cap) {
+            size_t ncap = *cap ? *cap * 2 : 256;
+            const char **np = realloc(*paths, ncap * sizeof(*np));
+
+            if (np == NULL)
+                break;
+            *paths = np;
+            *cap = ncap;
+        }
+        (*paths)[(*n)++] = line;
+        line = NULL;
+        linecap = 0;
+    }
+    free(line);
+    return ferror(stdin) ? -1 : 0;
+}
+
+//run_files() - counts the words in every file given after -i and, with
+//-L, every file listed on stdin.  Returns the exit code for main().
+int run_files(char opt, const stream_opts_t *so){
+    file_pool_t pool;
+    file_worker_t workers[MAX_THREADS];
+    work_queue_t queues[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    bool started[MAX_THREADS];
+    const char **paths = NULL;
+    size_t npaths = 0, cap = 0;
+    size_t total = 0;
+    int threads = so->threads;
+    int rc = 0;
+
+    if (opt != 'c' || so->in_place) {
+        printf("Several files only work with -c, exiting!\n");
+        return 1;
+    }
+
+    cap = so->npaths;
+    paths = malloc((cap ? cap : 1) * sizeof(*paths));
+    if (paths == NULL)
+        return 2;
+    for (size_t i = 0; i < so->npaths; i++)
+        paths[npaths++] = so->paths[i];
+    if (so->list && read_path_list(&paths, &npaths, &cap) < 0) {
+        printf("Error reading the file list, exiting!\n");
+        rc = 2;
+    }
+
+    pool.paths = paths;
+    pool.npaths = npaths;
+    pool.utf8 = so->utf8;
+    pool.results = calloc(npaths ? npaths : 1, sizeof(file_result_t));
+    pool.queues = queues;
+    if (pool.results == NULL) {
+        free(paths);
+        return 2;
+    }
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if ((size_t)threads > npaths)
+        threads = npaths ? npaths : 1;
+    pool.nworkers = threads;
+
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init(&queues[i].lock, NULL);
+        queues[i].head = npaths * i / threads;
+        queues[i].tail = npaths * (i + 1) / threads;
+    }
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (file_worker_t){ &pool, i };
+        started[i] = pthread_create(&tids[i], NULL, file_worker_main, &workers[i]) == 0;
+    }
+    //a worker that couldn't be started has its files stolen by the others,
+    //and if none started this thread does the lot
+    for (int i = 0; i < threads; i++)
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    file_worker_main(&workers[0]);
+
+    printf("Word Count\n----------\n");
+    for (size_t i = 0; i < npaths; i++) {
+        if (pool.results[i].rc < 0) {
+            printf("Unable to read %s\n", paths[i]);
+            rc = 2;
+            continue;
+        }
+        printf("%8zu %s\n", pool.results[i].wc, paths[i]);
+        total += pool.results[i].wc;
+    }
+    printf("%8zu total\n", total);
+
+    for (int i = 0; i < threads; i++)
+        pthread_mutex_destroy(&queues[i].lock);
+    for (size_t i = so->npaths; i < npaths; i++)
+        free((char *)paths[i]);
+    free(paths);
+    free(pool.results);
+    return rc;
+}
+
+//run_stream() - runs option opt over the file so->path (or stdin for
+//"-") and returns the exit code for main()
+int run_stream(char opt, const stream_opts_t *so){
+    const char *path = so->path;
+    size_t wc = 0;
+    int fd;
+    int rc;
+
+    if (opt != 'c' && opt != 'r' && opt != 'w' && opt != 'f' && opt != 'x' &&
+        opt != 'R') {
+        printf("Invalid option %c provided, exiting!\n", opt);
+        return 1;
+    }
+    if (opt != 'c' && opt != 'f' && so->threads != 1) {
+        printf("Option -j only works with -c and -f, exiting!\n");
+        return 1;
+    }
+    if (so->in_place) {
+        if (opt != 'r' || strcmp(path, "-") == 0 || so->utf8) {
+            printf("Option --in-place only works with -r on a file without -u, exiting!\n");
+            return 1;
+        }
+        if (reverse_file(path) < 0) {
+            printf("Unable to reverse %s, exiting!\n", path);
+            return 2;
+        }
+        return 0;
+    }
+
+    fd = open_input(path);
+    if (fd < 0) {
+        printf("Unable to open %s, exiting!\n", path);
+        return 2;
+    }
+
+    switch (opt){
+        case 'c':
+            if (so->utf8)
+                rc = stream_count_words(fd, true, &wc);
+            else
+                rc = parallel_count_words(fd, so->threads, &wc);
+            if (rc == 0)
+                printf("Word Count: %zu\n", wc);
+            break;
+        case 'r':
+            rc = stream_reverse(fd, so->utf8);
+            break;
+        case 'R':
+            rc = stream_reverse_words(fd, so->utf8);
+            break;
+        case 'f': {
+            freq_table_t t;
+
+            rc = freq_init(&t);
+            if (rc == 0 && so->utf8)
+                rc = stream_freq(fd, true, &t);
+            else if (rc == 0)
+                rc = parallel_freq(fd, so->threads, &t);
+            if (rc == 0)
+                rc = freq_print(&t, so->top, so->by_key);
+            freq_free(&t);
+            break;
+        }
+        case 'x': {
+            matcher_t m;
+
+            //stdout is the new text, so the count goes to stderr
+            matcher_init(&m, so->find, strlen(so->find));
+            rc = stream_replace(fd, &m, so->replace, &wc);
+            if (rc == 0)
+                fprintf(stderr, "Replacements: %zu\n", wc);
+            break;
+        }
+        default:
+            printf("Word Print\n----------\n");
+            rc = stream_word_print(fd, so->utf8);
+            break;
+    }
+
+    if (fd != STDIN_FILENO)
+        close(fd);
+    if (rc < 0) {
+        printf("Error reading %s, exiting!\n", path);
+        return 2;
+    }
+    return 0;
+}
+//BENCHMARK SUITE (-b)
+//
+//Times every operation, and every kernel of each, on a set of generated
+//corpora that cover the easy and hard cases: all spaces, no spaces,
+//short words, long words, random utf-8 and text that looks like prose.
+//The corpora come from a fixed seed, so two runs on two builds measure
+//the same bytes.  Results are one CSV line per corpus, operation and
+//variant, with the best of BENCH_RUNS runs as MB/s and, on x86, as
+//timestamp counter cycles per byte.  Anything the operations print goes
+//to /dev/null while they are timed.
+
+enum { CORPUS_SPACES, CORPUS_NOSPACES, CORPUS_SHORT, CORPUS_LONG, CORPUS_UTF8,
+       CORPUS_TEXT, CORPUS_COUNT };
+
+static const char *corpus_names[CORPUS_COUNT] = {
+    "spaces", "nospaces", "short", "long", "utf8", "text"
+};
+
+//xorshift64*
+static uint64_t bench_rand(uint64_t *state){
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//gen_corpus() - fills buf with len bytes of corpus kind
+static void gen_corpus(int kind, char *buf, size_t len){
+    static const char *prose[] = {
+        "the", "of", "and", "to", "a", "in", "is", "it", "that", "was",
+        "for", "on", "with", "as", "his", "they", "be", "at", "one", "have",
+        "this", "from", "word", "but", "what", "some", "other", "were", "all",
+        "there", "when", "your", "can", "said", "each", "which", "their",
+        "time", "will", "about", "many", "then", "them", "would", "write",
+        "like", "these", "number", "people", "shell", "process", "program"
+    };
+    static const char *utf8_chars[] = {
+        "a", "e", "z", " ", " ", "\xc3\xa9", "\xc3\xbc", "\xd0\xb6",
+        "\xe4\xb8\xad", "\xe6\x96\x87", "\xe3\x80\x80", "\xf0\x9f\x98\x80"
+    };
+    uint64_t seed = BENCH_SEED + kind;
+    size_t i = 0;
+
+    while (i < len) {
+        uint64_t r = bench_rand(&seed);
+        const char *piece;
+        size_t n;
+
+        switch (kind) {
+            case CORPUS_SPACES:
+                memset(buf, ' ', len);
+                return;
+            case CORPUS_NOSPACES:
+                memset(buf, 'x', len);
+                return;
+            case CORPUS_SHORT:
+            case CORPUS_LONG:
+                n = kind == CORPUS_SHORT ? 1 + r % 4 : 20 + r % 41;
+                for (size_t k = 0; k < n && i < len; k++)
+                    buf[i++] = 'a' + (r >> (k % 48)) % 26;
+                if (i < len)
+                    buf[i++] = ' ';
+                continue;
+            case CORPUS_UTF8:
+                piece = utf8_chars[r % (sizeof(utf8_chars) / sizeof(utf8_chars[0]))];
+                break;
+            default:
+                //a few words are very common, most are rare, like real text
+                r %= 1000;
+                piece = prose[(r * r / 1000) * (sizeof(prose) / sizeof(prose[0])) / 1000];
+                n = strlen(piece);
+                if (i + n + 2 > len)
+                    break;
+                memcpy(buf + i, piece, n);
+                i += n;
+                if (r % 13 == 0)
+                    buf[i++] = r % 2 ? ',' : '.';
+                piece = " ";
+                break;
+        }
+        n = strlen(piece);
+        if (i + n > len) {
+            //never cut a utf-8 character in half at the end
+            memset(buf + i, ' ', len - i);
+            return;
+        }
+        memcpy(buf + i, piece, n);
+        i += n;
+    }
+}
+
+typedef struct bench_ctx {
+    const char *buf;    //the corpus
+    char *work;         //a copy the in-place operations can change
+    size_t len;
+    int fd;             //the corpus in a temporary file
+} bench_ctx_t;
+
+static volatile size_t bench_sink;  //keeps results from being optimized out
+
+static void b_memcpy(bench_ctx_t *c){ memcpy(c->work, c->buf, c->len); }
+
+static void b_count(bench_ctx_t *c, count_words_fn fn){
+    bool in_word = false;
+
+    bench_sink = fn(c->buf, c->len, &in_word);
+}
+static void b_count_scalar(bench_ctx_t *c){ b_count(c, count_words_scalar); }
+static void b_count_utf8(bench_ctx_t *c){ b_count(c, count_words_utf8); }
+#ifdef HAVE_X86_SIMD
+static void b_count_sse2(bench_ctx_t *c){ b_count(c, count_words_sse2); }
+static void b_count_avx2(bench_ctx_t *c){ b_count(c, count_words_avx2); }
+#endif
+
+static void b_count_stream(bench_ctx_t *c){
+    size_t wc = 0;
+
+    lseek(c->fd, 0, SEEK_SET);
+    stream_count_words(c->fd, false, &wc);
+    bench_sink = wc;
+}
+
+//the same through read(), to compare with the mapped file above
+static void b_count_read(bench_ctx_t *c){
+    use_mmap = false;
+    b_count_stream(c);
+    use_mmap = true;
+}
+
+static void b_count_parallel(bench_ctx_t *c){
+    size_t wc = 0;
+
+    lseek(c->fd, 0, SEEK_SET);
+    parallel_count_words(c->fd, 0, &wc);
+    bench_sink = wc;
+}
+
+static void b_reverse_scalar(bench_ctx_t *c){ reverse_buf_scalar(c->work, c->len); }
+static void b_reverse_utf8(bench_ctx_t *c){ reverse_utf8(c->work, c->len); }
+#ifdef HAVE_X86_SIMD
+static void b_reverse_sse2(bench_ctx_t *c){ reverse_buf_sse2(c->work, c->len); }
+static void b_reverse_avx2(bench_ctx_t *c){ reverse_buf_avx2(c->work, c->len); }
+#endif
+
+static void b_word_print(bench_ctx_t *c){
+    word_print_state_t st = {0, 0, false};
+
+    word_print_buf(c->buf, c->len, &st);
+    word_print_end(&st);
+}
+
+static void b_freq(bench_ctx_t *c){
+    freq_table_t t;
+
+    if (freq_init(&t) == 0 && freq_add_buf(&t, c->buf, c->len, false) == 0)
+        freq_finish(&t);
+    bench_sink = t.used;
+    freq_free(&t);
+}
+
+static void b_replace(bench_ctx_t *c){
+    matcher_t m;
+    size_t count = 0;
+
+    matcher_init(&m, "the", 3);
+    replace_buf(&m, "THE", 3, c->buf, c->len, true, &count);
+    out_flush();
+    bench_sink = count;
+}
+
+typedef struct bench_case {
+    const char *op;
+    const char *variant;
+    void (*fn)(bench_ctx_t *);
+    bool avx2;          //only run when the cpu has avx2
+} bench_case_t;
+
+static const bench_case_t bench_cases[] = {
+    { "memcpy",     "baseline", b_memcpy,         false },
+    { "count",      "scalar",   b_count_scalar,   false },
+#ifdef HAVE_X86_SIMD
+    { "count",      "sse2",     b_count_sse2,     false },
+    { "count",      "avx2",     b_count_avx2,     true },
+#endif
+    { "count",      "utf8",     b_count_utf8,     false },
+    { "count",      "mmap",     b_count_stream,   false },
+    { "count",      "read",     b_count_read,     false },
+    { "count",      "parallel", b_count_parallel, false },
+    { "reverse",    "scalar",   b_reverse_scalar, false },
+#ifdef HAVE_X86_SIMD
+    { "reverse",    "sse2",     b_reverse_sse2,   false },
+    { "reverse",    "avx2",     b_reverse_avx2,   true },
+#endif
+    { "reverse",    "utf8",     b_reverse_utf8,   false },
+    { "word_print", "buffered", b_word_print,     false },
+    { "freq",       "arena",    b_freq,           false },
+    { "replace",    "simd",     b_replace,        false },
+};
+
+static double now_sec(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_cycles(void){
+#ifdef HAVE_X86_SIMD
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+//bench_suite() - runs every case on every corpus of mb megabytes and
+//prints the csv
+int bench_suite(size_t mb){
+    size_t len = mb * 1024 * 1024;
+    char *buf = malloc(len);
+    char *work = malloc(len);
+    FILE *csv = NULL;
+    int saved = -1, devnull = -1;
+    int rc = 0;
+
+    if (buf == NULL || work == NULL)
+        goto out;
+
+    //the csv keeps the real stdout, everything else goes to /dev/null
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    devnull = open("/dev/null", O_WRONLY);
+    if (saved < 0 || devnull < 0 || (csv = fdopen(saved, "w")) == NULL)
+        goto out;
+    saved = -1;
+    dup2(devnull, STDOUT_FILENO);
+
+    fprintf(csv, "corpus,op,variant,bytes,seconds,mb_per_s,cycles_per_byte\n");
+    for (int k = 0; k < CORPUS_COUNT; k++) {
+        FILE *tmp = tmpfile();
+        bench_ctx_t ctx = { buf, work, len, -1 };
+
+        gen_corpus(k, buf, len);
+        memcpy(work, buf, len);
+        if (tmp == NULL || fwrite(buf, 1, len, tmp) != len || fflush(tmp) != 0) {
+            if (tmp != NULL)
+                fclose(tmp);
+            rc = -1;
+            break;
+        }
+        ctx.fd = fileno(tmp);
+
+        for (size_t b = 0; b < sizeof(bench_cases) / sizeof(bench_cases[0]); b++) {
+            const bench_case_t *bc = &bench_cases[b];
+            double best = 1e30;
+            uint64_t best_cycles = 0;
+
+#ifdef HAVE_X86_SIMD
+            if (bc->avx2 && !__builtin_cpu_supports("avx2"))
+                continue;
+#endif
+            for (int r = 0; r < BENCH_RUNS; r++) {
+                uint64_t c0 = now_cycles();
+                double t = now_sec();
+
+                bc->fn(&ctx);
+                t = now_sec() - t;
+                if (t < best) {
+                    best = t;
+                    best_cycles = now_cycles() - c0;
+                }
+            }
+            fprintf(csv, "%s,%s,%s,%zu,%.6f,%.1f,", corpus_names[k], bc->op,
+                    bc->variant, len, best, len / best / 1e6);
+            if (best_cycles > 0)
+                fprintf(csv, "%.3f", (double)best_cycles / len);
+            fprintf(csv, "\n");
+            fflush(csv);
+        }
+        fclose(tmp);
+    }
+
+out:
+    if (buf == NULL || work == NULL || csv == NULL)
+        rc = -1;
+    fflush(stdout);
+    if (csv != NULL) {
+        dup2(fileno(csv), STDOUT_FILENO);
+        fclose(csv);
+    }
+    if (saved >= 0)
+        close(saved);
+    if (devnull >= 0)
+        close(devnull);
+    free(buf);
+    free(work);
+    return rc;
+}
+
+
+int main(int argc, char *argv[]){
+    char *input_string;     //holds the string provided by the user on cmd line
+    char *opt_string;       //holds the option string in argv[1]
+    char opt;               //used to capture user option from cmd line
+
+    if (getenv(NO_MMAP_ENV) != NULL)
+        use_mmap = false;
+
+    //THIS BLOCK OF CODE HANDLES PROCESSING COMMAND LINE ARGS
+    if (argc < 2){
+        usage(argv[0]);
+        exit(1);
+    }
+    opt_string = argv[1];
+
+    //note arv[2] should be -h -r -w or -c, thus the option is
+    //the second character and a - is the first char
+    if((opt_string[0] != '-') && (strlen(opt_string) != 2)){
+        usage(argv[0]);
+        exit(1);
+    }
+
+    opt = opt_string[1];   //get the option flag
+
+    //handle the help flag and then exit normally
+    if (opt == 'h'){
+        usage(argv[0]);
+        exit(0);
+    }
+
+    //-b [MB] runs the benchmark suite
+    if (opt == 'b'){
+        size_t mb = argc >= 3 ? strtoul(argv[2], NULL, 10) : 16;
+
+        exit(bench_suite(mb > 0 ? mb : 16) < 0 ? 2 : 0);
+    }
+
+    //the rest of the args are the input string and the options that go
+    //with it.  -i streams the input from a file (or stdin for "-")
+    //instead of taking it from the command line.
+    stream_opts_t so = { .threads = 1, .top = -1 };
+    const char *seps_spec = NULL;
+    int first_arg = 2;
+
+    //-x takes the text to find and the text to replace it with first
+    if (opt == 'x'){
+        if (argc < 4 || argv[2][0] == '\0'){
+            usage(argv[0]);
+            exit(1);
+        }
+        so.find = argv[2];
+        so.replace = argv[3];
+        first_arg = 4;
+    }
+
+    input_string = NULL;
+    for (int i = first_arg; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0) {
+            so.path = "-";
+            so.paths = (const char **)&argv[i + 1];
+            so.npaths = 0;
+            while (i + 1 < argc && (argv[i + 1][0] != '-' || strcmp(argv[i + 1], "-") == 0)) {
+                so.npaths++;
+                i++;
+            }
+            if (so.npaths > 0)
+                so.path = so.paths[0];
+        } else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+            seps_spec = argv[++i];
+        } else if (strcmp(argv[i], "-L") == 0) {
+            so.list = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            so.threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--in-place") == 0) {
+            so.in_place = true;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            so.utf8 = true;
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            so.top = atol(argv[++i]);
+            if (so.top < 0)
+                so.top = 0;
+        } else if (strcmp(argv[i], "--by-key") == 0) {
+            so.by_key = true;
+        } else if (input_string == NULL) {
+            input_string = argv[i];
+        } else {
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    //-S changes what separates words for every operation
+    if (seps_spec != NULL){
+        if (so.utf8){
+            printf("Options -u and -S don't combine, exiting!\n");
+            exit(1);
+        }
+        if (sep_set_use(seps_spec) < 0){
+            printf("Empty separator set, exiting!\n");
+            exit(1);
+        }
+    }
+
+    //several files at once go to the worker pool
+    if (so.list || so.npaths > 1){
+        if (input_string != NULL){
+            usage(argv[0]);
+            exit(1);
+        }
+        exit(run_files(opt, &so));
+    }
+
+    //more than one operation letter, or -s, means a combined run
+    if (strlen(opt_string) > 2 || opt == 's'){
+        if ((so.path == NULL) == (input_string == NULL)){
+            usage(argv[0]);
+            exit(1);
+        }
+        exit(run_fused(opt_string + 1, &so, input_string));
+    }
+
+    if (so.path != NULL){
+        if (input_string != NULL){
+            usage(argv[0]);
+            exit(1);
+        }
+        exit(run_stream(opt, &so));
+    }
+
+    //Finally the input string must be on the command line
+    if (input_string == NULL || so.threads != 1 || so.in_place){
+        usage(argv[0]);
+        exit(1);
+    }
+    //ALL ARGS PROCESSED - The string you are working with is
+    //in input_string
+    
+    switch (opt){
+        case 'c':
+            int wc = 0;         //variable for the word count
+
+            //TODO: #2. Call count_words, return of the result
+            //          should go into the wc variable
+            if (so.utf8) {
+                bool in_word = false;
+
+                wc = count_words_utf8(input_string, strlen(input_string), &in_word);
+            } else {
+                wc = count_words(input_string); //calling count_words 
+            }
+            printf("Word Count: %d\n", wc);
+            break;
+        case 'r':
+            //TODO: #3. Call reverse string using input_string
+            //          input string should be reversed
+            if (so.utf8)
+                reverse_utf8(input_string, strlen(input_string));
+            else
+                reverse_string(input_string);   //calling input_string
+            printf("Reversed string: %s\n", input_string);
+
+            //TODO:  #4.  The algorithm provided in the directions 
+            //            state we simply return after swapping all 
+            //            characters because the string is reversed 
+            //            in place.  Briefly explain why the string 
+            //            is reversed in place - place in a comment
+            //ANSWER:
+                    //The string is reversed in place because the reverse_string() function directly modifies the 
+                    //original input_string array. It swaps characters within the existing memory allocated for the 
+                    //string; it doesn't create a new string. Therefore, when the function returns, the original 
+                    //input_string has been modified, and no further action is needed to "return" the reversed string.
+            break;
+        case 'R':
+            if (reverse_words(input_string, strlen(input_string), so.utf8) < 0) {
+                printf("Out of memory, exiting!\n");
+                exit(2);
+            }
+            printf("Reversed words: %s\n", input_string);
+            break;
+        case 'w':
+            printf("Word Print\n----------\n");
+
+            //TODO: #5. Call word_print, output should be
+            //          printed by that function
+            if (so.utf8) {
+                word_print_state_t st = {0, 0, false};
+
+                word_print_utf8_buf(input_string, strlen(input_string), &st);
+                word_print_end(&st);
+            } else {
+                word_print(input_string); //calling word_print
+            }
+            break;
+        case 'f': {
+            freq_table_t t;
+
+            if (freq_init(&t) < 0 ||
+                freq_add_buf(&t, input_string, strlen(input_string), so.utf8) < 0 ||
+                freq_finish(&t) < 0 || freq_print(&t, so.top, so.by_key) < 0) {
+                printf("Out of memory, exiting!\n");
+                exit(2);
+            }
+            freq_free(&t);
+            break;
+        }
+        case 'x': {
+            matcher_t m;
+            size_t count = 0;
+
+            matcher_init(&m, so.find, strlen(so.find));
+            printf("Replaced string: ");
+            replace_buf(&m, so.replace, strlen(so.replace), input_string,
+                        strlen(input_string), true, &count);
+            out_put("\n", 1);
+            out_flush();
+            printf("Replacements: %zu\n", count);
+            break;
+        }
 
         //TODO: #6. In this code, the default case handles invalid command-line options passed to the program. If the user provides an 
                     //option other than 'c', 'r', or 'w', the default block executes, displaying a usage message and an error indicating 
@@ -0,0 +1,112 @@
+#!/usr/bin/env bats
+
+# File: student_tests.sh
+# 
+# Create your unit tests suit in this file
+
+setup() {
+    gcc -O2 -pthread -o stringfun "stringfun(answers).c"
+    # 49152 copies of "abc " is 3 * 64K bytes, so -j 3 splits it into
+    # three 64K ranges and the second and third each start on a word
+    awk 'BEGIN { for (i = 0; i < 49152; i++) printf "abc " }' > boundary.txt
+    # 2 * 64K + 1 bytes, the last word sits past an even split into two
+    awk 'BEGIN { for (i = 0; i < 131071; i++) printf "x"; printf " y" }' > tail.txt
+}
+
+teardown() {
+    rm -f stringfun boundary.txt tail.txt
+}
+
+@test "Frequency with -j counts a word on a range boundary once" {
+    run ./stringfun -f -i boundary.txt -k 0 -j 3
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="WordFrequency--------------49152abc"
+
+    echo "Output: $output"
+    echo "Exit Status: $status"
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Frequency with -j and no mmap counts a word on a range boundary once" {
+    STRINGFUN_NO_MMAP=1 run ./stringfun -f -i boundary.txt -k 0 -j 3
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="WordFrequency--------------49152abc"
+
+    echo "Output: $output"
+    echo "Exit Status: $status"
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Count with -j reaches the end of the file" {
+    run ./stringfun -c -i tail.txt -j 2
+
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$output" = "Word Count: 2" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Count with -j and no mmap reaches the end of the file" {
+    STRINGFUN_NO_MMAP=1 run ./stringfun -c -i tail.txt -j 2
+
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$output" = "Word Count: 2" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Frequency with -j reaches the end of the file" {
+    run ./stringfun -f -i tail.txt -k 0 -j 2
+
+    # the long word of x's is one word, y is the word in the last byte
+    echo "Exit Status: $status"
+
+    [ "$(echo "$output" | wc -l)" -eq 4 ]
+    [ "$(echo "$output" | tail -n 1)" = "      1 y" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Frequency with -j and no mmap reaches the end of the file" {
+    STRINGFUN_NO_MMAP=1 run ./stringfun -f -i tail.txt -k 0 -j 2
+
+    # the long word of x's is one word, y is the word in the last byte
+    echo "Exit Status: $status"
+
+    [ "$(echo "$output" | wc -l)" -eq 4 ]
+    [ "$(echo "$output" | tail -n 1)" = "      1 y" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Reverse with -u leaves a surrogate as invalid bytes" {
+    run ./stringfun -r $'x\xed\xa0\x80' -u
+
+    stripped_output=$(echo "$output" | od -An -tx1 | tr -d '[:space:]')
+    expected_output=$(echo "Reversed string: "$'\x80\xa0\xedx' | od -An -tx1 | tr -d '[:space:]')
+
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
+
+@test "Reverse words with -u keeps invalid utf-8 words as they were" {
+    run ./stringfun -R $'\xe4\xb8\xc3 \xe4\xb8' -u
+
+    stripped_output=$(echo "$output" | od -An -tx1 | tr -d '[:space:]')
+    expected_output=$(echo "Reversed words: "$'\xe4\xb8 \xe4\xb8\xc3' | od -An -tx1 | tr -d '[:space:]')
+
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$status" -eq 0 ]
+}
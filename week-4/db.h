@@ -31,5 +31,8 @@ static const int DELETED_STUDENT_ID = 0;
 
 #define DB_FILE     "student.db"            //name of database file
 #define TMP_DB_FILE ".tmp_student.db"       //for extra credit
+#define CDC_FILE    "student.cdc"           //change log, rotated to .1 .2 ...
+#define SHARD_MANIFEST "student.manifest"   //present when the db is sharded
+#define HLL_FILE    "student.hll"           //distinct name sketches
 
 #endif
\ No newline at end of file
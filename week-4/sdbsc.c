@@ -1,3 +1,4 @@
+#define _GNU_SOURCE //SEEK_DATA and SEEK_HOLE for the scan engine
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h> //c library for system call file routines
@@ -5,6 +6,17 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h> //sse2 compares for the query engine
+#endif
 
 // database include files
 #include "db.h"
@@ -147,17 +159,24 @@ int add_student(int fd, int id, char *fname, char *lname, int gpa)
 
     //Calculating index for the student 
     if (read_file == 0 || memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0){ 
-    //if it matches then copy all relevent fields    
+    //if it matches then copy all relevent fields, starting from an empty
+    //record so the name fields are always zero padded
+    student = EMPTY_STUDENT_RECORD;
     student.id = id;
     strncpy(student.fname, fname, sizeof(student.fname) - 1);
     strncpy(student.lname, lname, sizeof(student.lname) - 1);
     student.gpa = gpa;
 
-    int write_file = write(fd, &student, STUDENT_RECORD_SIZE); //declaring field to write to file
+    //the read above moved the file offset past the slot, so write at the
+    //slot's offset explicitly
+    int write_file = pwrite(fd, &student, STUDENT_RECORD_SIZE, offset); //declaring field to write to file
 
     if(write_file == STUDENT_RECORD_SIZE) {
         printf(M_STD_ADDED,id);
-        return NO_ERROR;
+        // the sketch is only an estimate and is rebuilt by the next full
+        // scan, so failing to update it does not fail the add
+        hll_record_students(&student, 1);
+        return cdc_append(CDC_OP_ADD, &student);
     } 
     else {
         printf(M_ERR_DB_WRITE);
@@ -227,8 +246,175 @@ int del_student(int fd, int id)
     }
 
     printf(M_STD_DEL_MSG,id); //Print sucess message
+    hll_mark_stale();
+    return cdc_append(CDC_OP_DEL, &student);
+
+}
+
+/*
+ *  update_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be updated
+ *      fname:  new first name
+ *      lname:  new last name
+ *      gpa:    new GPA as an integer (range defined in db.h)
+ *
+ *  Replaces the record of an existing student.  Like del_student() the
+ *  student is located with get_student() first.
+ *
+ *  returns:  NO_ERROR       student updated
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      student not in database
+ *
+ *  console:  M_STD_UPDATED      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be updated
+ *            M_ERR_DB_WRITE     error writing to db file
+ *
+ */
+int update_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    student_t student;
+
+    int rc = get_student(fd, id, &student);
+    if (rc == SRCH_NOT_FOUND)
+    {
+        printf(M_STD_NOT_FND_MSG, id);
+        return ERR_DB_OP;
+    }
+    else if (rc != NO_ERROR)
+        return ERR_DB_FILE;
+
+    student = EMPTY_STUDENT_RECORD;
+    student.id = id;
+    strncpy(student.fname, fname, sizeof(student.fname) - 1);
+    strncpy(student.lname, lname, sizeof(student.lname) - 1);
+    student.gpa = gpa;
+
+    if (pwrite(fd, &student, STUDENT_RECORD_SIZE, (off_t)id * STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_STD_UPDATED, id);
+    hll_record_students(&student, 1);
+    hll_mark_stale();
+    return cdc_append(CDC_OP_UPD, &student);
+}
+
+/*
+ *  scan_db
+ *      fd:       linux file descriptor
+ *      start_id: first student id (slot) to scan
+ *      end_id:   scan stops before this id (slot)
+ *      fn:       callback invoked with each batch of live records
+ *      ctx:      passed through to fn
+ *
+ *  This is the scan engine used by the full table operations.  Instead of
+ *  reading one record per read() call, it reads up to SCAN_BATCH_RECORDS
+ *  records at a time with pread(), so the file offset is never touched.
+ *  Since the database is a sparse file, lseek() with SEEK_DATA / SEEK_HOLE
+ *  is used to jump over holes without reading them at all.  Empty and
+ *  deleted slots inside a batch are squeezed out before the batch is handed
+ *  to fn, so callbacks only ever see real students.
+ *
+ *  returns:  NO_ERROR       scan completed (or fn asked to stop early)
+ *            ERR_DB_FILE    database file I/O issue
+ *            <negative>     an error code returned by fn
+ *
+ *  console:  Does not produce any console I/O
+ *
+ */
+int scan_db(int fd, int start_id, int end_id, scan_fn_t fn, void *ctx)
+{
+    student_t batch[SCAN_BATCH_RECORDS];
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return ERR_DB_FILE;
+
+    off_t pos = (off_t)start_id * STUDENT_RECORD_SIZE;
+    off_t end = (off_t)end_id * STUDENT_RECORD_SIZE;
+    if (end > st.st_size)
+        end = st.st_size;
+
+    while (pos < end)
+    {
+        // find the next region of the file that actually holds data
+        off_t data = lseek(fd, pos, SEEK_DATA);
+        if (data == -1)
+        {
+            if (errno == ENXIO)
+                break;          // only a hole is left
+            data = pos;         // filesystem cant tell us, read everything
+        }
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > end)
+            hole = end;
+
+        // extents are block aligned, records are not, so round outward
+        data -= data % STUDENT_RECORD_SIZE;
+        if (data < pos)
+            data = pos;
+        if (hole % STUDENT_RECORD_SIZE)
+            hole += STUDENT_RECORD_SIZE - hole % STUDENT_RECORD_SIZE;
+        if (hole > end)
+            hole = end;
+
+        for (pos = data; pos < hole; )
+        {
+            size_t want = hole - pos;
+            if (want > sizeof(batch))
+                want = sizeof(batch);
+
+            ssize_t got = pread(fd, batch, want, pos);
+            if (got == -1)
+                return ERR_DB_FILE;
+            if (got < STUDENT_RECORD_SIZE)
+                return NO_ERROR;    // short file, nothing else to read
+
+            int n = got / STUDENT_RECORD_SIZE;
+            pos += (off_t)n * STUDENT_RECORD_SIZE;
+
+            // squeeze out empty and deleted slots
+            int live = 0;
+            for (int i = 0; i < n; i++)
+            {
+                if (memcmp(&batch[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
+                {
+                    if (live != i)
+                        batch[live] = batch[i];
+                    live++;
+                }
+            }
+
+            if (live > 0)
+            {
+                int rc = fn(batch, live, ctx);
+                if (rc != NO_ERROR)
+                    return rc < 0 ? rc : NO_ERROR;
+            }
+        }
+    }
+
     return NO_ERROR;
+}
+
+// scan_db callback for count_db_records(), a full scan also rebuilds the
+// distinct name sketch when hll is set
+typedef struct count_ctx {
+    int count;
+    hll_t *hll;
+} count_ctx_t;
+
+static int count_batch(student_t *batch, int n, void *ctx)
+{
+    count_ctx_t *cc = ctx;
 
+    cc->count += n;
+    if (cc->hll != NULL)
+        hll_add_students(cc->hll, batch, n);
+    return NO_ERROR;
 }
 
 /*
@@ -257,26 +443,17 @@ int del_student(int fd, int id)
  */
 int count_db_records(int fd)
 {
-    // TODO
-
-    student_t student;
-    int file_read;
-    int count = 0;
+    hll_t hll;
+    count_ctx_t cc = {0, &hll};
 
-    lseek(fd, 0, SEEK_SET);  // lseek for the beginning of the file
-
-    while ((file_read = read(fd, &student, STUDENT_RECORD_SIZE)) > 0)
-    {
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) {
-            count ++;
-        }
-    }
-    
-    if (file_read == -1)
+    hll_init(&hll);
+    if (scan_db(fd, 0, MAX_STD_ID + 1, count_batch, &cc) < 0)
     {
         printf(M_ERR_DB_READ);  // Error reading the file
         return ERR_DB_FILE;
     }
+    hll_save(HLL_FILE, &hll);   // the scan saw every student, refresh the sketch
+    int count = cc.count;
     
     if(count == 0){
         printf(M_DB_EMPTY);
@@ -287,6 +464,37 @@ int count_db_records(int fd)
     }
 }
 
+// scan_db callback for print_db().  Rows go to out, the header is printed
+// before the first row unless the caller prints it itself (shards)
+typedef struct print_ctx {
+    FILE *out;
+    int printed;
+    bool no_header;
+    hll_t *hll;         // rebuilt along the way when set
+} print_ctx_t;
+
+static int print_batch(student_t *batch, int n, void *ctx)
+{
+    print_ctx_t *pc = ctx;
+
+    if (pc->hll != NULL)
+        hll_add_students(pc->hll, batch, n);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (pc->printed++ == 0 && !pc->no_header)
+            fprintf(pc->out, STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+
+        // Calculate GPA from the integer value (divide by 100.0 to get float)
+        float calculated_gpa = batch[i].gpa / 100.0;
+
+        // Print the student's information in the required format
+        fprintf(pc->out, STUDENT_PRINT_FMT_STRING, batch[i].id, batch[i].fname, batch[i].lname, calculated_gpa);
+    }
+
+    return NO_ERROR;
+}
+
 /*
  *  print_db
  *      fd:     linux file descriptor
@@ -322,47 +530,475 @@ int count_db_records(int fd)
  */
 int print_db(int fd)
 {
-    // TODO
-    student_t student;
-    int file_read;
-    int first_entry = 1;
+    hll_t hll;
+    print_ctx_t pc = {stdout, 0, false, &hll};
+
+    hll_init(&hll);
+    if (scan_db(fd, 0, MAX_STD_ID + 1, print_batch, &pc) < 0)
+    {
+        printf(M_ERR_DB_READ);  // Error reading the file
+        return ERR_DB_FILE;
+    }
+    hll_save(HLL_FILE, &hll);
+
+    // If no valid records were found
+    if (pc.printed == 0) {
+        printf(M_DB_EMPTY);  // Database is empty
+    }
+
+    return NO_ERROR;
+}
+
+// scan_db callback for scan_page(), stops the scan once the page is full
+typedef struct page_ctx {
+    student_t *out;
+    int limit;
+    int count;
+} page_ctx_t;
+
+static int page_batch(student_t *batch, int n, void *ctx)
+{
+    page_ctx_t *pc = ctx;
+    int take = pc->limit - pc->count;
+
+    if (take > n)
+        take = n;
+    memcpy(pc->out + pc->count, batch, (size_t)take * STUDENT_RECORD_SIZE);
+    pc->count += take;
+
+    return pc->count == pc->limit ? 1 : NO_ERROR;
+}
+
+/*
+ *  scan_page
+ *      fd:        linux file descriptor, ignored when map is given
+ *      *map:      shard map, NULL when the db is a single file
+ *      from_id:   cursor, the first id that may be returned
+ *      limit:     maximum number of students to return
+ *      *out:      room for limit students
+ *      *next_id:  set to the cursor for the next page, 0 at the end of the db
+ *
+ *  Returns one page of students in id order starting at from_id.  The scan
+ *  starts at from_id * STUDENT_RECORD_SIZE and skips holes and empty slots
+ *  like every other scan, and it stops as soon as the page is full, so the
+ *  cost of a page does not depend on how deep into the db it starts.  With
+ *  a shard map the shards are walked in order starting with the shard that
+ *  holds from_id.
+ *
+ *  returns:  <number>       number of students copied to out
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ *
+ */
+int scan_page(int fd, shard_map_t *map, int from_id, int limit, student_t *out, int *next_id)
+{
+    page_ctx_t pc = {out, limit, 0};
+
+    if (from_id < 0)
+        from_id = 0;
+    *next_id = 0;
+    if (limit <= 0)
+        return 0;
+
+    if (map == NULL)
+    {
+        if (scan_db(fd, from_id, MAX_STD_ID + 1, page_batch, &pc) < 0)
+            return ERR_DB_FILE;
+    }
+    for (int i = 0; map != NULL && i < map->nshards && pc.count < limit; i++)
+    {
+        shard_t *sh = &map->shards[i];
+        if (sh->hi <= from_id)
+            continue;
+        if (scan_db(sh->fd, from_id > sh->lo ? from_id : sh->lo, sh->hi, page_batch, &pc) < 0)
+            return ERR_DB_FILE;
+    }
+
+    // a full page may have more after it, a short page hit the end
+    if (pc.count == limit && out[limit - 1].id < MAX_STD_ID)
+        *next_id = out[limit - 1].id + 1;
+    return pc.count;
+}
+
+/*
+ *  print_page
+ *      fd:       linux file descriptor, ignored when map is given
+ *      *map:     shard map, NULL when the db is a single file
+ *      from_id:  cursor to start the page at
+ *      limit:    page size
+ *
+ *  Prints one page from scan_page() in the print_db() format, followed by
+ *  the cursor to pass to --from for the next page.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      out of memory for the page
+ *
+ *  console:  the page followed by M_PAGE_NEXT or M_PAGE_END
+ *            M_DB_EMPTY       if the first page is empty
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *
+ */
+int print_page(int fd, shard_map_t *map, int from_id, int limit)
+{
+    int next_id;
+
+    if (limit > MAX_STD_ID)
+        limit = MAX_STD_ID;
+    student_t *page = malloc((size_t)(limit > 0 ? limit : 1) * STUDENT_RECORD_SIZE);
+    if (page == NULL)
+        return ERR_DB_OP;
+
+    int n = scan_page(fd, map, from_id, limit, page, &next_id);
+    if (n < 0)
+    {
+        printf(M_ERR_DB_READ);
+        free(page);
+        return ERR_DB_FILE;
+    }
+
+    print_ctx_t pc = {stdout, 0, false, NULL};
+    print_batch(page, n, &pc);
+    if (n == 0 && from_id <= MIN_STD_ID)
+        printf(M_DB_EMPTY);
+
+    if (next_id > 0)
+        printf(M_PAGE_NEXT, next_id);
+    else
+        printf(M_PAGE_END);
+
+    free(page);
+    return NO_ERROR;
+}
 
-    lseek(fd, 0, SEEK_SET); // Position to the beginning of the file
+/*
+ *  compile_query
+ *      text:  query string from the command line
+ *      *q:    query program to fill in
+ *
+ *  A query is a list of terms of the form <field><op><value> joined by
+ *  "and" / "or" ("and" binds tighter).  Fields are id, gpa, fname and
+ *  lname.  Numeric fields take =, ==, !=, <, <=, > and >=, a gpa may be
+ *  written as an int (350) or as a real gpa (3.50).  Name fields take =,
+ *  == and != plus ^= for a prefix match, and the value may be quoted with
+ *  single or double quotes.  For example:
+ *
+ *      gpa>=350 and lname^="Sm" or id<10
+ *
+ *  returns:  NO_ERROR       query compiled into *q
+ *            ERR_QUERY      syntax error
+ *
+ *  console:  M_ERR_QUERY    on a syntax error
+ *
+ */
+int compile_query(const char *text, query_t *q)
+{
+    static const char *fields[] = {"id", "gpa", "fname", "lname"};
+    const char *p = text;
+    const char *tok = text;     // start of the token being parsed
 
-    while ((file_read = read(fd, &student, STUDENT_RECORD_SIZE)) > 0) //start reading from the beginning provided that there are entries in the file
+    memset(q, 0, sizeof(*q));
+
+    while (1)
     {
-        // Check if the current student record is empty or deleted
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0) 
-        { 
-            if (first_entry)
+        query_term_t *t;
+        int len;
+
+        while (isspace((unsigned char)*p))
+            p++;
+        tok = p;
+        if (q->nterms == QUERY_MAX_TERMS || *p == '\0')
+            goto bad;
+        t = &q->terms[q->nterms];
+
+        // field name
+        while (isalpha((unsigned char)*p))
+            p++;
+        len = p - tok;
+        t->field = -1;
+        for (int i = 0; i < (int)(sizeof(fields) / sizeof(fields[0])); i++)
+        {
+            if ((int)strlen(fields[i]) == len && strncasecmp(tok, fields[i], len) == 0)
+                t->field = i;
+        }
+        if (t->field < 0)
+            goto bad;
+
+        // operator
+        while (isspace((unsigned char)*p))
+            p++;
+        tok = p;
+        if (strncmp(p, "^=", 2) == 0)      { t->op = Q_OP_PREFIX; p += 2; }
+        else if (strncmp(p, "==", 2) == 0) { t->op = Q_OP_EQ; p += 2; }
+        else if (strncmp(p, "!=", 2) == 0) { t->op = Q_OP_NE; p += 2; }
+        else if (strncmp(p, "<=", 2) == 0) { t->op = Q_OP_LE; p += 2; }
+        else if (strncmp(p, ">=", 2) == 0) { t->op = Q_OP_GE; p += 2; }
+        else if (*p == '=')                { t->op = Q_OP_EQ; p++; }
+        else if (*p == '<')                { t->op = Q_OP_LT; p++; }
+        else if (*p == '>')                { t->op = Q_OP_GT; p++; }
+        else
+            goto bad;
+
+        // value
+        while (isspace((unsigned char)*p))
+            p++;
+        tok = p;
+        if (t->field == Q_FLD_ID || t->field == Q_FLD_GPA)
+        {
+            char *endp;
+            if (t->op == Q_OP_PREFIX)
+                goto bad;
+            double v = strtod(p, &endp);
+            if (endp == p)
+                goto bad;
+            // a gpa with a decimal point is a real gpa, store it scaled
+            if (t->field == Q_FLD_GPA && memchr(p, '.', endp - p) != NULL)
+                v = v * 100.0 + 0.5;
+            t->num = (int)v;
+            p = endp;
+        }
+        else
+        {
+            int width = (t->field == Q_FLD_FNAME) ? 24 : 32;
+            if (t->op != Q_OP_EQ && t->op != Q_OP_NE && t->op != Q_OP_PREFIX)
+                goto bad;
+            if (*p == '"' || *p == '\'')
+            {
+                char quote = *p++;
+                tok = p;
+                while (*p != '\0' && *p != quote)
+                    p++;
+                if (*p != quote)
+                    goto bad;
+                len = p++ - tok;
+            }
+            else
             {
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
-                first_entry = 0;  // Set flag to false after the first record
+                while (*p != '\0' && !isspace((unsigned char)*p))
+                    p++;
+                len = p - tok;
             }
+            if (len > width)
+                goto bad;
+            memcpy(t->str, tok, len);
+            t->str_len = len;
+        }
+        q->nterms++;
+
+        // connector or end of query
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '\0')
+            return NO_ERROR;
+
+        // a connector needs a next term, and terms[] may already be full
+        tok = p;
+        if (q->nterms == QUERY_MAX_TERMS)
+            goto bad;
+        if (strncasecmp(p, "and", 3) == 0 && !isalnum((unsigned char)p[3]))
+            p += 3;
+        else if (strncmp(p, "&&", 2) == 0)
+            p += 2;
+        else if (strncasecmp(p, "or", 2) == 0 && !isalnum((unsigned char)p[2]))
+        {
+            p += 2;
+            q->terms[q->nterms].starts_group = 1;
+        }
+        else if (strncmp(p, "||", 2) == 0)
+        {
+            p += 2;
+            q->terms[q->nterms].starts_group = 1;
+        }
+        else
+            goto bad;
+    }
+
+bad:
+    printf(M_ERR_QUERY, *tok ? tok : "<end of query>");
+    return ERR_QUERY;
+}
 
-            // Calculate GPA from the integer value (divide by 100.0 to get float)
-            float calculated_gpa = student.gpa / 100.0;
+// compare a numeric value against a term operand
+static inline int query_cmp_num(int v, int op, int k)
+{
+    switch (op)
+    {
+    case Q_OP_EQ: return v == k;
+    case Q_OP_NE: return v != k;
+    case Q_OP_LT: return v < k;
+    case Q_OP_LE: return v <= k;
+    case Q_OP_GT: return v > k;
+    default:      return v >= k;
+    }
+}
+
+/*
+ *  eval_num_term / eval_name_term
+ *
+ *  Evaluate one term over a whole batch, writing 1 or 0 per record into
+ *  out[].  Working a column at a time keeps the inner loops branch free.
+ *  The numeric compares are done four records at a time with SSE2 where
+ *  it is available; the record is 64 bytes so the four ints are gathered
+ *  from a 16 int stride.  Names are fixed width char arrays padded with
+ *  zeros, so a prefix match is a single memcmp() of the operand length and
+ *  an exact match additionally checks the byte after the operand.
+ */
+static void eval_num_term(const student_t *recs, int n, const query_term_t *t,
+                          unsigned char *out)
+{
+    size_t off = (t->field == Q_FLD_ID) ? offsetof(student_t, id)
+                                        : offsetof(student_t, gpa);
+    const char *base = (const char *)recs + off;
+    int i = 0;
+
+#define QFIELD(i) (*(const int *)(base + (size_t)(i) * STUDENT_RECORD_SIZE))
+#ifdef __SSE2__
+    __m128i k = _mm_set1_epi32(t->num);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_set_epi32(QFIELD(i + 3), QFIELD(i + 2),
+                                  QFIELD(i + 1), QFIELD(i));
+        __m128i m;
+        int invert = 0;
 
-            // Print the student's information in the required format
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, calculated_gpa);
+        switch (t->op)
+        {
+        case Q_OP_EQ: m = _mm_cmpeq_epi32(v, k); break;
+        case Q_OP_NE: m = _mm_cmpeq_epi32(v, k); invert = 1; break;
+        case Q_OP_LT: m = _mm_cmplt_epi32(v, k); break;
+        case Q_OP_LE: m = _mm_cmpgt_epi32(v, k); invert = 1; break;
+        case Q_OP_GT: m = _mm_cmpgt_epi32(v, k); break;
+        default:      m = _mm_cmplt_epi32(v, k); invert = 1; break;
         }
+
+        int bits = _mm_movemask_ps(_mm_castsi128_ps(m));
+        if (invert)
+            bits = ~bits;
+        out[i]     = bits & 1;
+        out[i + 1] = (bits >> 1) & 1;
+        out[i + 2] = (bits >> 2) & 1;
+        out[i + 3] = (bits >> 3) & 1;
     }
+#endif
+    for (; i < n; i++)
+        out[i] = query_cmp_num(QFIELD(i), t->op, t->num);
+#undef QFIELD
+}
+
+static void eval_name_term(const student_t *recs, int n, const query_term_t *t,
+                           unsigned char *out)
+{
+    int width = (t->field == Q_FLD_FNAME) ? 24 : 32;
+    int len = t->str_len;
 
-    // Check if there was an error reading the file
-    if (file_read == -1) 
+    for (int i = 0; i < n; i++)
     {
-        printf(M_ERR_DB_READ);  // Error reading the file
-        return ERR_DB_FILE;
+        const char *name = (t->field == Q_FLD_FNAME) ? recs[i].fname : recs[i].lname;
+        int hit = memcmp(name, t->str, len) == 0;
+
+        if (t->op != Q_OP_PREFIX)
+        {
+            hit = hit && (len == width || name[len] == '\0');
+            if (t->op == Q_OP_NE)
+                hit = !hit;
+        }
+        out[i] = hit;
     }
+}
 
-    // If no valid records were found
-    if (first_entry) {
-        printf(M_DB_EMPTY);  // Database is empty
+/*
+ *  query_batch
+ *
+ *  Runs a compiled query over one batch from scan_db().  Each term produces
+ *  a mask for the whole batch, terms are and-ed into the current group and
+ *  groups are or-ed into the result.  Matching records are then printed.
+ */
+typedef struct query_ctx {
+    query_t *q;
+    FILE *out;
+    int matched;
+    bool no_header;
+} query_ctx_t;
+
+static int query_batch(student_t *batch, int n, void *ctx)
+{
+    query_ctx_t *qc = ctx;
+    unsigned char term[SCAN_BATCH_RECORDS];
+    unsigned char group[SCAN_BATCH_RECORDS];
+    unsigned char result[SCAN_BATCH_RECORDS];
+
+    memset(result, 0, n);
+    memset(group, 1, n);
+
+    for (int t = 0; t < qc->q->nterms; t++)
+    {
+        query_term_t *qt = &qc->q->terms[t];
+
+        if (qt->starts_group)
+        {
+            for (int i = 0; i < n; i++)
+                result[i] |= group[i];
+            memset(group, 1, n);
+        }
+
+        if (qt->field == Q_FLD_ID || qt->field == Q_FLD_GPA)
+            eval_num_term(batch, n, qt, term);
+        else
+            eval_name_term(batch, n, qt, term);
+
+        for (int i = 0; i < n; i++)
+            group[i] &= term[i];
+    }
+    for (int i = 0; i < n; i++)
+        result[i] |= group[i];
+
+    for (int i = 0; i < n; i++)
+    {
+        if (!result[i])
+            continue;
+        if (qc->matched++ == 0 && !qc->no_header)
+            fprintf(qc->out, STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+        fprintf(qc->out, STUDENT_PRINT_FMT_STRING, batch[i].id, batch[i].fname,
+                batch[i].lname, batch[i].gpa / 100.0);
     }
 
     return NO_ERROR;
 }
 
+/*
+ *  query_db
+ *      fd:     linux file descriptor
+ *      *q:     query compiled by compile_query()
+ *
+ *  Prints every record in the database that matches the query, using the
+ *  same table format as print_db().
+ *
+ *  returns:  <number>       the number of matching records
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  matching records followed by M_QUERY_MATCH_CNT, or
+ *            M_QUERY_NO_MATCH if nothing matched
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *
+ */
+int query_db(int fd, query_t *q)
+{
+    query_ctx_t qc = {q, stdout, 0, false};
+
+    if (scan_db(fd, 0, MAX_STD_ID + 1, query_batch, &qc) < 0)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (qc.matched == 0)
+        printf(M_QUERY_NO_MATCH);
+    else
+        printf(M_QUERY_MATCH_CNT, qc.matched);
+
+    return qc.matched;
+}
 
 /*
  *  print_student
@@ -468,56 +1104,1391 @@ int compress_db(int fd)
 }
 
 /*
- *  validate_range
- *      id:  proposed student id
- *      gpa: proposed gpa
- *
- *  This function validates that the id and gpa are in the allowable ranges
- *  as per the specifications.  It checks if the values are within the
- *  inclusive range using constents in db.h
- *
- *  returns:    NO_ERROR       on success, both ID and GPA are in range
- *              EXIT_FAIL_ARGS if either ID or GPA is out of range
+ *  cdc_last_lsn
+ *      log_fd:  fd of the current change log
  *
- *  console:  This function does not produce any output
+ *  Finds the lsn of the newest change record.  That is the last record of
+ *  the current log, or of CDC_FILE.1 if the log was just rotated.  A torn
+ *  record at the end of the log (crash in the middle of a write) is cut off.
  *
+ *  returns:  the last lsn, 0 if there are no change records yet
  */
-int validate_range(int id, int gpa)
+static unsigned long long cdc_last_lsn(int log_fd)
 {
+    cdc_record_t rec;
+    struct stat st;
+    char path[PATH_MAX];
 
-    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
-        return EXIT_FAIL_ARGS;
+    if (fstat(log_fd, &st) == 0)
+    {
+        off_t end = st.st_size - st.st_size % sizeof(rec);
+        if (end != st.st_size && ftruncate(log_fd, end) == -1)
+            return 0;
+        if (end > 0 && pread(log_fd, &rec, sizeof(rec), end - sizeof(rec)) == sizeof(rec))
+            return rec.lsn;
+    }
 
-    if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
-        return EXIT_FAIL_ARGS;
+    snprintf(path, sizeof(path), "%s.1", CDC_FILE);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
 
-    return NO_ERROR;
+    unsigned long long lsn = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(rec))
+    {
+        off_t end = st.st_size - st.st_size % sizeof(rec);
+        if (pread(fd, &rec, sizeof(rec), end - sizeof(rec)) == sizeof(rec))
+            lsn = rec.lsn;
+    }
+    close(fd);
+    return lsn;
 }
 
-/*
- *  usage
- *      exename:  the name of the executable from argv[0]
- *
- *  Prints this programs expected usage
- *
- *  returns:    nothing, this is a void function
- *
- *  console:  This function prints the usage information
+// shifts CDC_FILE.n to CDC_FILE.n+1 and CDC_FILE to CDC_FILE.1
+static void cdc_rotate(void)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+
+    for (int i = CDC_KEEP_FILES - 1; i >= 1; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", CDC_FILE, i);
+        snprintf(to, sizeof(to), "%s.%d", CDC_FILE, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", CDC_FILE);
+    rename(CDC_FILE, to);
+}
+
+// opens CDC_FILE and takes an exclusive flock() on it.  If the log got
+// rotated while we waited for the lock, the lock is on the old file, so
+// let go and try again with the new one.
+static int cdc_open_locked(void)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    struct stat st_fd, st_name;
+
+    while (1)
+    {
+        int log_fd = open(CDC_FILE, O_RDWR | O_CREAT | O_APPEND, mode);
+        if (log_fd == -1)
+            return -1;
+        if (flock(log_fd, LOCK_EX) == -1)
+        {
+            close(log_fd);
+            return -1;
+        }
+        if (fstat(log_fd, &st_fd) == 0 && stat(CDC_FILE, &st_name) == 0 &&
+            st_fd.st_ino == st_name.st_ino)
+            return log_fd;
+        close(log_fd);
+    }
+}
+
+/*
+ *  cdc_append
+ *      op:   CDC_OP_xxx
+ *      *s:   the student record that was added, updated or deleted
+ *
+ *  Appends one change record to CDC_FILE, see cdc_append_many().
+ *
+ *  returns:  NO_ERROR       change recorded
+ *            ERR_DB_FILE    the change log could not be written
+ *
+ *  console:  M_ERR_CDC_WRITE  if the change log could not be written
+ *
+ */
+int cdc_append(int op, const student_t *s)
+{
+    return cdc_append_many(op, s, 1);
+}
+
+/*
+ *  cdc_append_many
+ *      op:   CDC_OP_xxx, the same for every record
+ *      *s:   array of n student records that were changed
+ *      n:    number of records
+ *
+ *  Appends n change records with consecutive lsns to CDC_FILE.  The log is
+ *  locked with flock() while the lsns are picked and the records are
+ *  written so that concurrent sdbsc processes, and processes working on
+ *  different shards, produce one gap free sequence.  The log is rotated
+ *  before the write if it has grown past CDC_MAX_BYTES; the new log is
+ *  locked before the old one is let go.
+ *
+ *  returns:  NO_ERROR       changes recorded
+ *            ERR_DB_FILE    the change log could not be written
+ *
+ *  console:  M_ERR_CDC_WRITE  if the change log could not be written
+ *
+ */
+int cdc_append_many(int op, const student_t *s, int n)
+{
+    cdc_record_t recs[64];
+    struct stat st;
+    int rc = ERR_DB_FILE;
+
+    int log_fd = cdc_open_locked();
+    if (log_fd != -1 && fstat(log_fd, &st) == 0 && st.st_size >= CDC_MAX_BYTES)
+    {
+        cdc_rotate();
+        int new_fd = cdc_open_locked();
+        close(log_fd);      // also drops the lock on the old log
+        log_fd = new_fd;
+    }
+
+    if (log_fd != -1)
+    {
+        unsigned long long lsn = cdc_last_lsn(log_fd);
+
+        rc = NO_ERROR;
+        for (int done = 0; done < n && rc == NO_ERROR; )
+        {
+            int cnt = n - done;
+            if (cnt > (int)(sizeof(recs) / sizeof(recs[0])))
+                cnt = sizeof(recs) / sizeof(recs[0]);
+
+            memset(recs, 0, sizeof(recs));
+            for (int i = 0; i < cnt; i++)
+            {
+                recs[i].lsn = ++lsn;
+                recs[i].op = op;
+                recs[i].student = s[done + i];
+            }
+
+            ssize_t len = (ssize_t)cnt * sizeof(cdc_record_t);
+            if (write(log_fd, recs, len) != len)
+                rc = ERR_DB_FILE;
+            done += cnt;
+        }
+        close(log_fd);
+    }
+
+    if (rc != NO_ERROR)
+        printf(M_ERR_CDC_WRITE);
+    return rc;
+}
+
+// prints change records from log_fd starting at *offset, advancing *offset
+static int cdc_print_from(int log_fd, off_t *offset, unsigned long long from_lsn)
+{
+    static const char *op_names[] = {"?", "add", "del", "upd", "zero"};
+    cdc_record_t recs[64];
+    ssize_t got;
+
+    while ((got = pread(log_fd, recs, sizeof(recs), *offset)) > 0)
+    {
+        int n = got / sizeof(cdc_record_t);
+        if (n == 0)
+            break;      // partial record, the writer is not done yet
+
+        for (int i = 0; i < n; i++)
+        {
+            cdc_record_t *r = &recs[i];
+            if (r->lsn < from_lsn)
+                continue;
+            printf(CDC_PRINT_FMT_STRING, r->lsn,
+                   (r->op > 0 && r->op <= CDC_OP_ZERO) ? op_names[r->op] : op_names[0],
+                   r->student.id, r->student.fname, r->student.lname, r->student.gpa);
+        }
+        *offset += (off_t)n * sizeof(cdc_record_t);
+    }
+    fflush(stdout);
+
+    return got < 0 ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  follow_changes
+ *      from_lsn:  first lsn to print, 0 to only print changes made from now on
+ *
+ *  Tails the change log like "tail -F".  When from_lsn is given, changes
+ *  still held in the rotated logs are replayed first, oldest log first.
+ *  Then the current log is watched with inotify.  A modify event means new
+ *  records were appended.  A create or rename of CDC_FILE means the log was
+ *  rotated, so what is left of the old log is drained and the new one is
+ *  opened.  This function only returns on error.
+ *
+ *  returns:  ERR_DB_FILE    the change log could not be read or watched
+ *
+ *  console:  one CDC_PRINT_FMT_STRING line per change record
+ *            M_ERR_CDC_FOLLOW  on error
+ *
+ */
+int follow_changes(unsigned long long from_lsn)
+{
+    char path[PATH_MAX];
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct stat st_name, st_fd;
+    off_t offset = 0;
+    int log_fd;
+
+    int ino_fd = inotify_init1(IN_CLOEXEC);
+    if (ino_fd == -1 || inotify_add_watch(ino_fd, ".", IN_MODIFY | IN_CREATE | IN_MOVED_TO) == -1)
+    {
+        printf(M_ERR_CDC_FOLLOW);
+        return ERR_DB_FILE;
+    }
+
+    // replay what is left in the rotated logs, oldest first
+    if (from_lsn > 0)
+    {
+        for (int i = CDC_KEEP_FILES; i >= 1; i--)
+        {
+            snprintf(path, sizeof(path), "%s.%d", CDC_FILE, i);
+            int old_fd = open(path, O_RDONLY);
+            if (old_fd == -1)
+                continue;
+            off_t old_offset = 0;
+            cdc_print_from(old_fd, &old_offset, from_lsn);
+            close(old_fd);
+        }
+    }
+
+    log_fd = open(CDC_FILE, O_RDONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (log_fd == -1)
+    {
+        printf(M_ERR_CDC_FOLLOW);
+        return ERR_DB_FILE;
+    }
+    if (from_lsn == 0 && fstat(log_fd, &st_fd) == 0)
+        offset = st_fd.st_size - st_fd.st_size % sizeof(cdc_record_t);
+
+    while (1)
+    {
+        if (cdc_print_from(log_fd, &offset, from_lsn) != NO_ERROR)
+            break;
+
+        // did the log rotate under us?
+        if (stat(CDC_FILE, &st_name) == 0 && fstat(log_fd, &st_fd) == 0 &&
+            st_name.st_ino != st_fd.st_ino)
+        {
+            cdc_print_from(log_fd, &offset, from_lsn);
+            close(log_fd);
+            log_fd = open(CDC_FILE, O_RDONLY);
+            if (log_fd == -1)
+                break;
+            offset = 0;
+            continue;
+        }
+
+        // wait until something happens to the log
+        ssize_t len = read(ino_fd, events, sizeof(events));
+        if (len <= 0 && errno != EINTR)
+            break;
+    }
+
+    printf(M_ERR_CDC_FOLLOW);
+    if (log_fd != -1)
+        close(log_fd);
+    close(ino_fd);
+    return ERR_DB_FILE;
+}
+
+/*
+ *  load_shard_map
+ *      *map:  filled in with the shards listed in SHARD_MANIFEST
+ *
+ *  Reads the manifest and opens every shard.  Lines starting with # are
+ *  comments.  The shard ranges must be in order and must not overlap.
+ *
+ *  returns:  NO_ERROR       the db is sharded, all shards are open
+ *            SRCH_NOT_FOUND there is no manifest, the db is a single file
+ *            ERR_DB_FILE    the manifest is bad or a shard cant be opened
+ *
+ *  console:  M_ERR_SHARD_MAP  if the manifest is bad
+ *            M_ERR_DB_OPEN    if a shard cant be opened
+ *
+ */
+int load_shard_map(shard_map_t *map)
+{
+    char line[PATH_MAX + 64];
+    FILE *mf;
+
+    memset(map, 0, sizeof(*map));
+
+    mf = fopen(SHARD_MANIFEST, "r");
+    if (mf == NULL)
+        return (errno == ENOENT) ? SRCH_NOT_FOUND : ERR_DB_FILE;
+
+    while (fgets(line, sizeof(line), mf) != NULL)
+    {
+        shard_t *sh = &map->shards[map->nshards];
+        int used = 0;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        line[strcspn(line, "\n")] = '\0';
+
+        if (map->nshards == SHARD_MAX ||
+            sscanf(line, "%d %d %n", &sh->lo, &sh->hi, &used) != 2 || used == 0 ||
+            line[used] == '\0' || sh->lo >= sh->hi ||
+            (map->nshards > 0 && sh->lo < map->shards[map->nshards - 1].hi))
+        {
+            printf(M_ERR_SHARD_MAP);
+            fclose(mf);
+            close_shard_map(map);
+            return ERR_DB_FILE;
+        }
+        strncpy(sh->path, line + used, sizeof(sh->path) - 1);
+
+        sh->fd = open_db(sh->path, false);
+        if (sh->fd < 0)
+        {
+            fclose(mf);
+            close_shard_map(map);
+            return ERR_DB_FILE;
+        }
+        map->nshards++;
+    }
+    fclose(mf);
+
+    if (map->nshards == 0)
+    {
+        printf(M_ERR_SHARD_MAP);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+// closes every shard that load_shard_map() opened
+void close_shard_map(shard_map_t *map)
+{
+    for (int i = 0; i < map->nshards; i++)
+        close(map->shards[i].fd);
+    map->nshards = 0;
+}
+
+/*
+ *  shard_fd
+ *      *map:  shard map from load_shard_map()
+ *      id:    student id
+ *
+ *  returns:  the fd of the shard holding id, or ERR_DB_FILE if no shard
+ *            covers it
+ */
+int shard_fd(shard_map_t *map, int id)
+{
+    for (int i = 0; i < map->nshards; i++)
+    {
+        if (id >= map->shards[i].lo && id < map->shards[i].hi)
+            return map->shards[i].fd;
+    }
+    return ERR_DB_FILE;
+}
+
+// scan_db callback for create_shards(), copies each record into its shard
+static int split_batch(student_t *batch, int n, void *ctx)
+{
+    shard_map_t *map = ctx;
+
+    for (int i = 0; i < n; i++)
+    {
+        int sfd = shard_fd(map, batch[i].id);
+        if (sfd < 0 ||
+            pwrite(sfd, &batch[i], STUDENT_RECORD_SIZE,
+                   (off_t)batch[i].id * STUDENT_RECORD_SIZE) != STUDENT_RECORD_SIZE)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  create_shards
+ *      fd:       linux file descriptor of the single file db
+ *      nshards:  number of shards to split the id range into
+ *      dirs:     directories to place the shards in, used round robin
+ *      ndirs:    number of entries in dirs, 0 places every shard in "."
+ *
+ *  Splits the id range into nshards equal ranges, creates a shard file
+ *  for each range (named DB_FILE.<n>), copies the existing records into
+ *  their shards and then writes SHARD_MANIFEST.  The manifest is written
+ *  to a temporary file and renamed into place so a reader never sees a
+ *  partial one.  Once the manifest is in place the records in the single
+ *  file db are no longer used, so it is truncated.
+ *
+ *  returns:  NO_ERROR       db split into shards
+ *            ERR_DB_OP      bad shard count or the db is already sharded
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_SHARDED_OK    on success
+ *            M_ERR_SHARD_CNT    nshards out of range
+ *            M_ERR_SHARD_EXIST  there already is a manifest
+ *            M_ERR_DB_CREATE    a shard or the manifest cant be created
+ *            M_ERR_DB_WRITE     error copying records into the shards
+ *
+ */
+int create_shards(int fd, int nshards, char **dirs, int ndirs)
+{
+    char tmp_manifest[PATH_MAX];
+    shard_map_t map;
+    int span;
+    FILE *mf;
+
+    if (nshards < 1 || nshards > SHARD_MAX)
+    {
+        printf(M_ERR_SHARD_CNT, SHARD_MAX);
+        return ERR_DB_OP;
+    }
+    if (access(SHARD_MANIFEST, F_OK) == 0)
+    {
+        printf(M_ERR_SHARD_EXIST);
+        return ERR_DB_OP;
+    }
+
+    memset(&map, 0, sizeof(map));
+    span = (MAX_STD_ID - MIN_STD_ID + nshards) / nshards;
+    for (int i = 0; i < nshards; i++)
+    {
+        shard_t *sh = &map.shards[i];
+
+        sh->lo = MIN_STD_ID + i * span;
+        sh->hi = (i == nshards - 1) ? MAX_STD_ID + 1 : sh->lo + span;
+        snprintf(sh->path, sizeof(sh->path), "%s/%s.%d",
+                 ndirs > 0 ? dirs[i % ndirs] : ".", DB_FILE, i);
+
+        sh->fd = open_db(sh->path, true);
+        if (sh->fd < 0)
+        {
+            close_shard_map(&map);
+            return ERR_DB_FILE;
+        }
+        map.nshards++;
+    }
+
+    if (scan_db(fd, 0, MAX_STD_ID + 1, split_batch, &map) < 0)
+    {
+        printf(M_ERR_DB_WRITE);
+        close_shard_map(&map);
+        return ERR_DB_FILE;
+    }
+
+    snprintf(tmp_manifest, sizeof(tmp_manifest), ".tmp_%s", SHARD_MANIFEST);
+    mf = fopen(tmp_manifest, "w");
+    if (mf == NULL)
+    {
+        printf(M_ERR_DB_CREATE);
+        close_shard_map(&map);
+        return ERR_DB_FILE;
+    }
+    fprintf(mf, "# sdbsc shard manifest: lo hi path (hi is exclusive)\n");
+    for (int i = 0; i < nshards; i++)
+        fprintf(mf, "%d %d %s\n", map.shards[i].lo, map.shards[i].hi, map.shards[i].path);
+
+    int failed = (fflush(mf) != 0) || (fsync(fileno(mf)) != 0);
+    failed |= (fclose(mf) != 0);
+    for (int i = 0; i < nshards && !failed; i++)
+        failed = fsync(map.shards[i].fd) != 0;
+    close_shard_map(&map);
+
+    if (failed || rename(tmp_manifest, SHARD_MANIFEST) == -1)
+    {
+        printf(M_ERR_DB_CREATE);
+        unlink(tmp_manifest);
+        return ERR_DB_FILE;
+    }
+
+    if (ftruncate(fd, 0) == -1)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_SHARDED_OK, nshards);
+    return NO_ERROR;
+}
+
+// one scan_db() run over one shard, executed on its own thread
+typedef struct shard_job {
+    shard_t *shard;
+    scan_fn_t fn;
+    void *ctx;
+    int rc;
+} shard_job_t;
+
+static void *shard_scan_thread(void *arg)
+{
+    shard_job_t *job = arg;
+
+    job->rc = scan_db(job->shard->fd, job->shard->lo, job->shard->hi, job->fn, job->ctx);
+    return NULL;
+}
+
+/*
+ *  scan_shards
+ *      *map:  shard map from load_shard_map()
+ *      fn:    scan_db() callback
+ *      ctxs:  ctxs[i] is passed to fn for the batches of shard i
+ *
+ *  Scans all shards in parallel, one thread per shard.  Every shard has its
+ *  own ctx so callbacks dont need any locking; callers combine the per
+ *  shard results in shard (and therefore id) order afterwards.
+ *
+ *  returns:  NO_ERROR       all shards scanned
+ *            <negative>     the first error returned by a shard scan
+ *
+ *  console:  Does not produce any console I/O
+ */
+int scan_shards(shard_map_t *map, scan_fn_t fn, void **ctxs)
+{
+    shard_job_t jobs[SHARD_MAX];
+    pthread_t threads[SHARD_MAX];
+    bool started[SHARD_MAX];
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < map->nshards; i++)
+    {
+        jobs[i] = (shard_job_t){&map->shards[i], fn, ctxs[i], NO_ERROR};
+        started[i] = pthread_create(&threads[i], NULL, shard_scan_thread, &jobs[i]) == 0;
+        if (!started[i])
+            shard_scan_thread(&jobs[i]);    // no thread, scan it right here
+    }
+
+    for (int i = 0; i < map->nshards; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        if (jobs[i].rc < 0 && rc == NO_ERROR)
+            rc = jobs[i].rc;
+    }
+
+    return rc;
+}
+
+// a sketch per shard for the rebuild done by full shard scans.  Slot 0 is
+// the merged result, slot i + 1 belongs to shard i.  NULL when out of
+// memory, the scan then simply skips the rebuild.
+static hll_t *alloc_shard_hlls(int nshards)
+{
+    hll_t *hlls = malloc(sizeof(hll_t) * (nshards + 1));
+
+    for (int i = 0; hlls != NULL && i <= nshards; i++)
+        hll_init(&hlls[i]);
+    return hlls;
+}
+
+// merges the shard sketches into slot 0, saves it and frees them all
+static void save_shard_hlls(hll_t *hlls, int nshards)
+{
+    if (hlls == NULL)
+        return;
+    for (int i = 1; i <= nshards; i++)
+        hll_merge(&hlls[0], &hlls[i]);
+    hll_save(HLL_FILE, &hlls[0]);
+    free(hlls);
+}
+
+/*
+ *  count_shard_records, print_shards, query_shards
+ *
+ *  The sharded versions of count_db_records(), print_db() and query_db().
+ *  They produce exactly the same console output.  For printing, every shard
+ *  writes its rows into its own in memory stream while the shards are
+ *  scanned in parallel, then the streams are written out in shard order
+ *  under a single header.
+ */
+int count_shard_records(shard_map_t *map)
+{
+    count_ctx_t ccs[SHARD_MAX];
+    void *ctxs[SHARD_MAX];
+    int count = 0;
+
+    hll_t *hlls = alloc_shard_hlls(map->nshards);
+    for (int i = 0; i < map->nshards; i++)
+    {
+        ccs[i] = (count_ctx_t){0, hlls ? &hlls[i + 1] : NULL};
+        ctxs[i] = &ccs[i];
+    }
+
+    if (scan_shards(map, count_batch, ctxs) < 0)
+    {
+        printf(M_ERR_DB_READ);
+        free(hlls);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < map->nshards; i++)
+        count += ccs[i].count;
+    save_shard_hlls(hlls, map->nshards);
+
+    if (count == 0)
+        printf(M_DB_EMPTY);
+    else
+        printf(M_DB_RECORD_CNT, count);
+    return count;
+}
+
+// per shard output streams used by print_shards() and query_shards()
+typedef struct shard_out {
+    char *buf;
+    size_t len;
+    FILE *out;
+} shard_out_t;
+
+static int open_shard_outs(shard_out_t *outs, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        outs[i].buf = NULL;
+        outs[i].out = open_memstream(&outs[i].buf, &outs[i].len);
+        if (outs[i].out == NULL)
+        {
+            while (i-- > 0)
+            {
+                fclose(outs[i].out);
+                free(outs[i].buf);
+            }
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+// writes the shard outputs in order under one header, then frees them
+static void flush_shard_outs(shard_out_t *outs, int n, bool header)
+{
+    for (int i = 0; i < n; i++)
+        fclose(outs[i].out);
+
+    if (header)
+        printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST_NAME", "LAST_NAME", "GPA");
+    fflush(stdout);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (header)
+            fwrite(outs[i].buf, 1, outs[i].len, stdout);
+        free(outs[i].buf);
+    }
+}
+
+int print_shards(shard_map_t *map)
+{
+    print_ctx_t pcs[SHARD_MAX];
+    shard_out_t outs[SHARD_MAX];
+    void *ctxs[SHARD_MAX];
+    int printed = 0;
+
+    if (open_shard_outs(outs, map->nshards) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    hll_t *hlls = alloc_shard_hlls(map->nshards);
+    for (int i = 0; i < map->nshards; i++)
+    {
+        pcs[i] = (print_ctx_t){outs[i].out, 0, true, hlls ? &hlls[i + 1] : NULL};
+        ctxs[i] = &pcs[i];
+    }
+
+    int rc = scan_shards(map, print_batch, ctxs);
+    for (int i = 0; i < map->nshards; i++)
+        printed += pcs[i].printed;
+    flush_shard_outs(outs, map->nshards, rc == NO_ERROR && printed > 0);
+
+    if (rc < 0)
+    {
+        printf(M_ERR_DB_READ);
+        free(hlls);
+        return ERR_DB_FILE;
+    }
+    save_shard_hlls(hlls, map->nshards);
+    if (printed == 0)
+        printf(M_DB_EMPTY);
+    return NO_ERROR;
+}
+
+int query_shards(shard_map_t *map, query_t *q)
+{
+    query_ctx_t qcs[SHARD_MAX];
+    shard_out_t outs[SHARD_MAX];
+    void *ctxs[SHARD_MAX];
+    int matched = 0;
+
+    if (open_shard_outs(outs, map->nshards) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    for (int i = 0; i < map->nshards; i++)
+    {
+        qcs[i] = (query_ctx_t){q, outs[i].out, 0, true};
+        ctxs[i] = &qcs[i];
+    }
+
+    int rc = scan_shards(map, query_batch, ctxs);
+    for (int i = 0; i < map->nshards; i++)
+        matched += qcs[i].matched;
+    flush_shard_outs(outs, map->nshards, rc == NO_ERROR && matched > 0);
+
+    if (rc < 0)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    if (matched == 0)
+        printf(M_QUERY_NO_MATCH);
+    else
+        printf(M_QUERY_MATCH_CNT, matched);
+    return matched;
+}
+
+/*
+ *  zero_shards
+ *      *map:  shard map from load_shard_map()
+ *
+ *  Removes all records from every shard, the sharded version of -z.  The
+ *  shards themselves and the manifest are kept.
+ *
+ *  returns:  NO_ERROR       all shards emptied
+ *            ERR_DB_FILE    a shard could not be truncated
+ *
+ *  console:  M_ERR_DB_WRITE   if a shard could not be truncated
+ */
+int zero_shards(shard_map_t *map)
+{
+    for (int i = 0; i < map->nshards; i++)
+    {
+        if (ftruncate(map->shards[i].fd, 0) == -1)
+        {
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  copy_record_run
+ *      src_fd, fd:  source and target database files
+ *      first_id:    id of the first record of the run
+ *      n:           number of records in the run
+ *      *recs:       the same records, already read from the source
+ *
+ *  Copies a run of consecutive records to the same offsets in the target.
+ *  copy_file_range() lets the kernel move the data without it passing
+ *  through user space, and filesystems with reflinks (btrfs, xfs) can share
+ *  the blocks instead of copying them.  When the kernel cant do that for
+ *  this pair of files (different filesystems on old kernels, or no support
+ *  at all) the records we already have in memory are written instead.
+ */
+static int copy_record_run(int src_fd, int fd, int first_id, int n, const student_t *recs)
+{
+    off_t off_in = (off_t)first_id * STUDENT_RECORD_SIZE;
+    off_t off_out = off_in;
+    size_t left = (size_t)n * STUDENT_RECORD_SIZE;
+
+    while (left > 0)
+    {
+        ssize_t moved = copy_file_range(src_fd, &off_in, fd, &off_out, left, 0);
+        if (moved > 0)
+        {
+            left -= moved;
+            continue;
+        }
+        if (moved == -1 && errno != EXDEV && errno != ENOSYS &&
+            errno != EOPNOTSUPP && errno != EINVAL)
+            return ERR_DB_FILE;
+        break;
+    }
+
+    if (left > 0)
+    {
+        const char *tail = (const char *)recs + ((size_t)n * STUDENT_RECORD_SIZE - left);
+        if (pwrite(fd, tail, left, off_out) != (ssize_t)left)
+            return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  import_db
+ *      fd:        linux file descriptor of the target database (or shard)
+ *      src_fd:    linux file descriptor of the database to import
+ *      start_id:  first id to import
+ *      end_id:    import stops before this id
+ *      *stats:    counts of imported and conflicting records are added here
+ *
+ *  Merges the students of another database file into this one.  Only the
+ *  data extents of the source are visited (SEEK_DATA / SEEK_HOLE), a batch
+ *  at a time.  For every batch the same slots of the target are read and a
+ *  source student is taken when its slot in the target is empty.  If the
+ *  target already holds a different student with that id, the target wins
+ *  and the student is counted as a conflict.  Source records whose id does
+ *  not match their slot are corrupt and counted as conflicts too.  Every
+ *  run of consecutive students that can be taken is moved with a single
+ *  copy_record_run() call, and the whole batch is recorded in the change
+ *  log with one cdc_append_many() call.
+ *
+ *  returns:  NO_ERROR       import done
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_READ    error reading either database file
+ *            M_ERR_DB_WRITE   error writing to the target
+ *
+ */
+int import_db(int fd, int src_fd, int start_id, int end_id, import_stats_t *stats)
+{
+    student_t src[SCAN_BATCH_RECORDS];
+    student_t dst[SCAN_BATCH_RECORDS];
+    student_t taken[SCAN_BATCH_RECORDS];
+    struct stat st;
+
+    if (fstat(src_fd, &st) == -1)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    off_t pos = (off_t)start_id * STUDENT_RECORD_SIZE;
+    off_t end = (off_t)end_id * STUDENT_RECORD_SIZE;
+    if (end > st.st_size)
+        end = st.st_size;
+
+    while (pos < end)
+    {
+        off_t data = lseek(src_fd, pos, SEEK_DATA);
+        if (data == -1)
+        {
+            if (errno == ENXIO)
+                break;
+            data = pos;
+        }
+        off_t hole = lseek(src_fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > end)
+            hole = end;
+
+        data -= data % STUDENT_RECORD_SIZE;
+        if (data < pos)
+            data = pos;
+        if (hole % STUDENT_RECORD_SIZE)
+            hole += STUDENT_RECORD_SIZE - hole % STUDENT_RECORD_SIZE;
+        if (hole > end)
+            hole = end;
+
+        for (pos = data; pos < hole; )
+        {
+            size_t want = hole - pos;
+            if (want > sizeof(src))
+                want = sizeof(src);
+
+            ssize_t got = pread(src_fd, src, want, pos);
+            if (got == -1)
+            {
+                printf(M_ERR_DB_READ);
+                return ERR_DB_FILE;
+            }
+            int n = got / STUDENT_RECORD_SIZE;
+            if (n == 0)
+                return NO_ERROR;
+
+            // slots past the end of the target read as empty
+            memset(dst, 0, (size_t)n * STUDENT_RECORD_SIZE);
+            if (pread(fd, dst, (size_t)n * STUDENT_RECORD_SIZE, pos) == -1)
+            {
+                printf(M_ERR_DB_READ);
+                return ERR_DB_FILE;
+            }
+
+            int first_id = pos / STUDENT_RECORD_SIZE;
+            int ntaken = 0;
+            int run = -1;       // index where the current run started
+
+            for (int i = 0; i <= n; i++)
+            {
+                bool take = false;
+
+                if (i < n && memcmp(&src[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) != 0)
+                {
+                    if (src[i].id != first_id + i)
+                        stats->conflicts++;
+                    else if (memcmp(&dst[i], &EMPTY_STUDENT_RECORD, STUDENT_RECORD_SIZE) == 0)
+                        take = true;
+                    else if (memcmp(&dst[i], &src[i], STUDENT_RECORD_SIZE) != 0)
+                        stats->conflicts++;
+                }
+
+                if (take)
+                {
+                    if (run < 0)
+                        run = i;
+                    taken[ntaken++] = src[i];
+                    continue;
+                }
+                if (run >= 0)
+                {
+                    if (copy_record_run(src_fd, fd, first_id + run, i - run, &src[run]) != NO_ERROR)
+                    {
+                        printf(M_ERR_DB_WRITE);
+                        return ERR_DB_FILE;
+                    }
+                    run = -1;
+                }
+            }
+
+            if (ntaken > 0)
+            {
+                stats->imported += ntaken;
+                hll_record_students(taken, ntaken);
+                if (cdc_append_many(CDC_OP_ADD, taken, ntaken) != NO_ERROR)
+                    return ERR_DB_FILE;
+            }
+            pos += (off_t)n * STUDENT_RECORD_SIZE;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  hll_hash
+ *
+ *  64 bit FNV-1a over the bytes of a name, followed by the murmur3 finalizer
+ *  so every bit of the result depends on every input byte (FNV alone leaves
+ *  the top bits, which pick the register, poorly mixed).  seed lets the
+ *  name pair hash continue from the first name.
+ */
+static uint64_t hll_hash(const char *p, size_t n, uint64_t seed)
+{
+    uint64_t h = seed;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        h ^= (unsigned char)p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t hll_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// records hash h in one column: the top HLL_PRECISION bits pick the
+// register, the register keeps the longest run of leading zeros + 1 seen
+// in the remaining bits
+static inline void hll_add_hash(unsigned char *regs, uint64_t h)
+{
+    uint64_t rest = h << HLL_PRECISION;
+    unsigned char rank = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_PRECISION + 1;
+    unsigned char *reg = &regs[h >> (64 - HLL_PRECISION)];
+
+    if (*reg < rank)
+        *reg = rank;
+}
+
+// an empty sketch
+void hll_init(hll_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, "HLL1", 4);
+}
+
+// adds the names of n students to every column of the sketch
+void hll_add_students(hll_t *h, const student_t *s, int n)
+{
+    const uint64_t basis = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < n; i++)
+    {
+        size_t flen = strnlen(s[i].fname, sizeof(s[i].fname));
+        size_t llen = strnlen(s[i].lname, sizeof(s[i].lname));
+        uint64_t fh = hll_hash(s[i].fname, flen, basis);
+
+        hll_add_hash(h->regs[HLL_COL_FNAME], hll_mix(fh));
+        hll_add_hash(h->regs[HLL_COL_LNAME], hll_mix(hll_hash(s[i].lname, llen, basis)));
+        // a separator keeps "ab c" and "a bc" apart
+        hll_add_hash(h->regs[HLL_COL_NAME], hll_mix(hll_hash(s[i].lname, llen, hll_hash("", 1, fh))));
+    }
+}
+
+// dst becomes the sketch of the union of both inputs
+void hll_merge(hll_t *dst, const hll_t *src)
+{
+    for (int c = 0; c < HLL_COLUMNS; c++)
+    {
+        for (int i = 0; i < HLL_REGISTERS; i++)
+        {
+            if (dst->regs[c][i] < src->regs[c][i])
+                dst->regs[c][i] = src->regs[c][i];
+        }
+    }
+    dst->stale |= src->stale;
+}
+
+// natural log for hll_estimate(), so sdbsc does not need libm.  x is
+// brought into [1, 2) by powers of two, then ln(x) = 2 atanh((x-1)/(x+1))
+static double hll_ln(double x)
+{
+    const double ln2 = 0.69314718055994530942;
+    int k = 0;
+
+    while (x >= 2.0) { x /= 2.0; k++; }
+    while (x < 1.0)  { x *= 2.0; k--; }
+
+    double y = (x - 1.0) / (x + 1.0);
+    double y2 = y * y, term = y, sum = 0.0;
+    for (int i = 1; i < 40; i += 2)
+    {
+        sum += term / i;
+        term *= y2;
+    }
+    return 2.0 * sum + k * ln2;
+}
+
+/*
+ *  hll_estimate
+ *      *h:      sketch
+ *      column:  HLL_COL_xxx
+ *
+ *  The HyperLogLog estimate: the bias corrected harmonic mean of 2^register.
+ *  For small counts, when some registers are still zero, linear counting
+ *  over the empty registers is more accurate and is used instead.  With 64
+ *  bit hashes no large range correction is needed.
+ *
+ *  returns:  the estimated number of distinct values
+ */
+double hll_estimate(const hll_t *h, int column)
+{
+    const double m = HLL_REGISTERS;
+    const double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double sum = 0.0;
+    int zeros = 0;
+
+    for (int i = 0; i < HLL_REGISTERS; i++)
+    {
+        sum += 1.0 / (double)(1ULL << h->regs[column][i]);
+        zeros += (h->regs[column][i] == 0);
+    }
+
+    double e = alpha * m * m / sum;
+    if (e <= 2.5 * m && zeros > 0)
+        e = m * hll_ln(m / zeros);
+    return e;
+}
+
+/*
+ *  hll_load / hll_save
+ *
+ *  A sketch file is the hll_t structure as is.  hll_save() writes a
+ *  temporary file and renames it into place so readers always see a whole
+ *  sketch.
+ *
+ *  returns:  NO_ERROR       sketch loaded / saved
+ *            SRCH_NOT_FOUND (load) there is no sketch file
+ *            ERR_DB_FILE    the file cant be read / written or is not a sketch
+ */
+int hll_load(const char *path, hll_t *h)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return (errno == ENOENT) ? SRCH_NOT_FOUND : ERR_DB_FILE;
+
+    ssize_t got = read(fd, h, sizeof(*h));
+    close(fd);
+    if (got != sizeof(*h) || memcmp(h->magic, "HLL1", 4) != 0)
+        return ERR_DB_FILE;
+    return NO_ERROR;
+}
+
+int hll_save(const char *path, const hll_t *h)
+{
+    char tmp[PATH_MAX];
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd == -1)
+        return ERR_DB_FILE;
+
+    bool ok = write(fd, h, sizeof(*h)) == sizeof(*h);
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp, path) == -1)
+    {
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+    return NO_ERROR;
+}
+
+// opens HLL_FILE locked for a read-modify-write and reads the sketch.  A
+// missing sketch is not created here, a sketch of only the students being
+// changed would hide the rest of the db; -1 is returned with *missing set
+// and print_distinct() builds it with a full scan.  A damaged sketch reads
+// as empty and stale for the same reason.
+static int hll_open_locked(hll_t *h, bool *missing)
+{
+    int fd = open(HLL_FILE, O_RDWR);
+
+    *missing = (fd == -1 && errno == ENOENT);
+    if (fd == -1)
+        return -1;
+    if (flock(fd, LOCK_EX) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    if (pread(fd, h, sizeof(*h), 0) != sizeof(*h) || memcmp(h->magic, "HLL1", 4) != 0)
+    {
+        hll_init(h);
+        h->stale = 1;
+    }
+    return fd;
+}
+
+/*
+ *  hll_record_students
+ *      *s:  students that were just added to the db
+ *      n:   number of students
+ *
+ *  Adds the students to HLL_FILE in place, under an flock() so concurrent
+ *  adds dont lose each others registers.  Does nothing when there is no
+ *  sketch yet, the first -distinct builds it from every student.
+ *
+ *  returns:  NO_ERROR       sketch updated
+ *            ERR_DB_FILE    sketch file cant be read or written
+ */
+int hll_record_students(const student_t *s, int n)
+{
+    hll_t h;
+    bool missing;
+    int fd = hll_open_locked(&h, &missing);
+
+    if (fd == -1)
+        return missing ? NO_ERROR : ERR_DB_FILE;
+    hll_add_students(&h, s, n);
+    int rc = (pwrite(fd, &h, sizeof(h), 0) == sizeof(h)) ? NO_ERROR : ERR_DB_FILE;
+    close(fd);
+    return rc;
+}
+
+/*
+ *  hll_mark_stale
+ *
+ *  A sketch cant forget a value, so after a delete or an update it may
+ *  count names that are gone until the next full scan rebuilds it.  This
+ *  sets the stale flag in HLL_FILE so print_distinct() can say so.  There
+ *  is nothing to mark when there is no sketch yet.
+ *
+ *  returns:  NO_ERROR       flag set
+ *            ERR_DB_FILE    sketch file cant be read or written
+ */
+int hll_mark_stale(void)
+{
+    hll_t h;
+    bool missing;
+    int fd = hll_open_locked(&h, &missing);
+
+    if (fd == -1)
+        return missing ? NO_ERROR : ERR_DB_FILE;
+    h.stale = 1;
+    int rc = (pwrite(fd, &h, sizeof(h), 0) == sizeof(h)) ? NO_ERROR : ERR_DB_FILE;
+    close(fd);
+    return rc;
+}
+
+/*
+ *  print_distinct
+ *      fd:      linux file descriptor, ignored when map is given
+ *      *map:    shard map, NULL when the db is a single file
+ *      column:  "fname", "lname" or "name" (first and last name pair)
+ *      extra:   paths of other sketch files to merge in, for example the
+ *               student.hll of other departments
+ *      nextra:  number of entries in extra
+ *
+ *  Prints the estimated number of distinct values of a name column from
+ *  HLL_FILE.  There is no scan unless the db has no sketch yet, in which
+ *  case a quiet full scan builds one first.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_OP      unknown column
+ *            ERR_DB_FILE    a sketch or the db cant be read
+ *
+ *  console:  M_HLL_DISTINCT   the estimate and its standard error
+ *            M_HLL_STALE      if students were removed since the rebuild
+ *            M_ERR_HLL_COLUMN unknown column
+ *            M_ERR_HLL_READ   a sketch file cant be read
+ *
+ */
+int print_distinct(int fd, shard_map_t *map, char *column, char **extra, int nextra)
+{
+    static const char *columns[HLL_COLUMNS] = {"fname", "lname", "name"};
+    hll_t h, other;
+    int col = -1;
+
+    for (int i = 0; i < HLL_COLUMNS; i++)
+    {
+        if (strcmp(column, columns[i]) == 0)
+            col = i;
+    }
+    if (col < 0)
+    {
+        printf(M_ERR_HLL_COLUMN, column);
+        return ERR_DB_OP;
+    }
+
+    int rc = hll_load(HLL_FILE, &h);
+    if (rc == SRCH_NOT_FOUND)
+    {
+        // no sketch yet, build one with a full scan
+        hll_init(&h);
+        count_ctx_t cc = {0, &h};
+        rc = NO_ERROR;
+        if (map == NULL)
+            rc = scan_db(fd, 0, MAX_STD_ID + 1, count_batch, &cc);
+        for (int i = 0; map != NULL && i < map->nshards && rc >= 0; i++)
+            rc = scan_db(map->shards[i].fd, map->shards[i].lo, map->shards[i].hi, count_batch, &cc);
+        if (rc >= 0)
+            rc = hll_save(HLL_FILE, &h);
+    }
+    if (rc < 0)
+    {
+        printf(M_ERR_HLL_READ, HLL_FILE);
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < nextra; i++)
+    {
+        if (hll_load(extra[i], &other) != NO_ERROR)
+        {
+            printf(M_ERR_HLL_READ, extra[i]);
+            return ERR_DB_FILE;
+        }
+        hll_merge(&h, &other);
+    }
+
+    printf(M_HLL_DISTINCT, hll_estimate(&h, col), columns[col],
+           104.0 / (1 << (HLL_PRECISION / 2)));   // 1.04 / sqrt(m) as a percentage
+    if (h.stale)
+        printf(M_HLL_STALE);
+    return NO_ERROR;
+}
+
+/*
+ *  import_file
+ *      src_path:  path of the database file to import
+ *      fd:        linux file descriptor of the target database
+ *      *map:      shard map of the target, NULL when it is a single file
+ *      *stats:    filled in with the import counts
+ *
+ *  Opens src_path and runs import_db() over the whole id range, or once
+ *  per shard over the shard's range when the target is sharded.
+ *
+ *  returns:  NO_ERROR       import done
+ *            ERR_DB_OP      src_path is the target database itself
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_IMPORTED     on success
+ *            M_ERR_DB_OPEN     src_path cant be opened
+ *            M_ERR_IMPORT_SELF src_path is the target database
+ *
+ */
+int import_file(char *src_path, int fd, shard_map_t *map, import_stats_t *stats)
+{
+    struct stat st_src, st_dst;
+    int rc = NO_ERROR;
+
+    int src_fd = open(src_path, O_RDONLY);
+    if (src_fd == -1)
+    {
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    if (fstat(src_fd, &st_src) == 0 && fstat(fd, &st_dst) == 0 &&
+        st_src.st_dev == st_dst.st_dev && st_src.st_ino == st_dst.st_ino)
+    {
+        printf(M_ERR_IMPORT_SELF);
+        close(src_fd);
+        return ERR_DB_OP;
+    }
+
+    if (map == NULL)
+        rc = import_db(fd, src_fd, 0, MAX_STD_ID + 1, stats);
+    for (int i = 0; map != NULL && i < map->nshards && rc == NO_ERROR; i++)
+        rc = import_db(map->shards[i].fd, src_fd, map->shards[i].lo, map->shards[i].hi, stats);
+
+    close(src_fd);
+    if (rc == NO_ERROR)
+        printf(M_DB_IMPORTED, stats->imported, stats->conflicts);
+    return rc;
+}
+
+/*
+ *  validate_range
+ *      id:  proposed student id
+ *      gpa: proposed gpa
+ *
+ *  This function validates that the id and gpa are in the allowable ranges
+ *  as per the specifications.  It checks if the values are within the
+ *  inclusive range using constents in db.h
+ *
+ *  returns:    NO_ERROR       on success, both ID and GPA are in range
+ *              EXIT_FAIL_ARGS if either ID or GPA is out of range
+ *
+ *  console:  This function does not produce any output
+ *
+ */
+int validate_range(int id, int gpa)
+{
+
+    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+        return EXIT_FAIL_ARGS;
+
+    if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
+        return EXIT_FAIL_ARGS;
+
+    return NO_ERROR;
+}
+
+/*
+ *  usage
+ *      exename:  the name of the executable from argv[0]
+ *
+ *  Prints this programs expected usage
+ *
+ *  returns:    nothing, this is a void function
+ *
+ *  console:  This function prints the usage information
  *
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s -[h|a|c|d|f|p|q|u|z] options.  Where:\n", exename);
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
     printf("\t-c:  counts the records in the database\n");
     printf("\t-d id:  deletes a student\n");
+    printf("\t-distinct fname|lname|name [other.hll ...]:  estimates distinct names, merging other sketches\n");
     printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-follow [lsn]:  prints changes as they are made, replaying from lsn if given\n");
+    printf("\t-import other_db:  merges the students of other_db, existing students win\n");
     printf("\t-p:  prints all records in the student database\n");
+    printf("\t-p --from id --limit n:  prints one page of n records starting at id\n");
+    printf("\t-shard n [dir ...]:  splits the database into n shards by id range, spread over dirs\n");
+    printf("\t-q \"query\":  prints records matching a query, e.g. -q 'gpa>=350 and lname^=\"Sm\"'\n");
+    printf("\t-u id first_name last_name gpa(as 3 digit int):  updates a student\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
     printf("\t-z:  zero db file (remove all records)\n");
 }
 
+// options that are whole words rather than a single letter, each maps to
+// the option character used in the switch in main()
+static const struct long_opt {
+    const char *name;
+    char opt;
+} LONG_OPTS[] = {
+    {"-follow", 'F'},
+    {"-shard", 'S'},
+    {"-import", 'I'},
+    {"-distinct", 'D'},
+};
+
 // Welcome to main()
 int main(int argc, char *argv[])
 {
@@ -527,6 +2498,11 @@ int main(int argc, char *argv[])
     int exit_code; // exit code to shell
     int id;        // userid from argv[2]
     int gpa;       // gpa from argv[5]
+    query_t query; // compiled query for -q
+    shard_map_t shards; // shard layout, when SHARD_MANIFEST exists
+    bool sharded;
+    import_stats_t import_stats = {0};
+    hll_t empty_hll;  // -z resets the distinct name sketch
 
     // space for a student structure which we will get back from
     // some of the functions we will be writing such as get_student(),
@@ -544,6 +2520,11 @@ int main(int argc, char *argv[])
     // The option is the first character after the dash for example
     //-h -a -c -d -f -p -x -z
     opt = (char)*(argv[1] + 1); // get the option flag
+    for (size_t i = 0; i < sizeof(LONG_OPTS) / sizeof(LONG_OPTS[0]); i++)
+    {
+        if (strcmp(argv[1], LONG_OPTS[i].name) == 0)
+            opt = LONG_OPTS[i].opt;
+    }
 
     // handle the help flag and then exit normally
     if (opt == 'h')
@@ -561,6 +2542,16 @@ int main(int argc, char *argv[])
         exit(EXIT_FAIL_DB);
     }
 
+    // when the db is sharded, single record operations are routed to the
+    // shard holding the id and full table operations scan all shards
+    rc = load_shard_map(&shards);
+    if (rc == ERR_DB_FILE)
+    {
+        close(fd);
+        exit(EXIT_FAIL_DB);
+    }
+    sharded = (rc == NO_ERROR);
+
     // set rc to the return code of the operation to ensure the program
     // use that to determine the proper exit_code.  Look at the header
     // sdbsc.h for expected values.
@@ -592,7 +2583,7 @@ int main(int argc, char *argv[])
             break;
         }
 
-        rc = add_student(fd, id, argv[3], argv[4], gpa);
+        rc = add_student(sharded ? shard_fd(&shards, id) : fd, id, argv[3], argv[4], gpa);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
@@ -603,7 +2594,7 @@ int main(int argc, char *argv[])
         // prog_name     -c
         //-----------------
         // example:  prog_name -c
-        rc = count_db_records(fd);
+        rc = sharded ? count_shard_records(&shards) : count_db_records(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -620,7 +2611,7 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = del_student(fd, id);
+        rc = del_student(sharded ? shard_fd(&shards, id) : fd, id);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
@@ -638,7 +2629,7 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
-        rc = get_student(fd, id, &student);
+        rc = get_student(sharded ? shard_fd(&shards, id) : fd, id, &student);
 
         switch (rc)
         {
@@ -657,11 +2648,153 @@ int main(int argc, char *argv[])
         break;
 
     case 'p':
-        //    arv[0] arv[1]
-        // prog_name     -p
-        //-----------------
+        //    arv[0] arv[1]    arv[2] arv[3]     arv[4] arv[5]
+        // prog_name     -p  [--from     id]  [--limit      n]
+        //----------------------------------------------------
         // example:  prog_name -p
-        rc = print_db(fd);
+        // example:  prog_name -p --from 1200 --limit 50
+        if (argc == 2)
+        {
+            rc = sharded ? print_shards(&shards) : print_db(fd);
+            if (rc < 0)
+                exit_code = EXIT_FAIL_DB;
+            break;
+        }
+
+        id = 0;
+        int limit = PAGE_DEFAULT_LIMIT;
+        for (int i = 2; i < argc; i += 2)
+        {
+            if (i + 1 < argc && strcmp(argv[i], "--from") == 0)
+                id = atoi(argv[i + 1]);
+            else if (i + 1 < argc && strcmp(argv[i], "--limit") == 0)
+                limit = atoi(argv[i + 1]);
+            else
+                exit_code = EXIT_FAIL_ARGS;
+        }
+        if (exit_code == EXIT_FAIL_ARGS || id < 0 || limit < 1)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+
+        rc = print_page(fd, sharded ? &shards : NULL, id, limit);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'u':
+        //   arv[0] arv[1]  arv[2]      arv[3]    arv[4]  arv[5]
+        // prog_name     -u      id  first_name last_name     gpa
+        //-------------------------------------------------------
+        // example:  prog_name -u 1 John Doe 355
+        if (argc != 6)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        id = atoi(argv[2]);
+        gpa = atoi(argv[5]);
+
+        exit_code = validate_range(id, gpa);
+        if (exit_code == EXIT_FAIL_ARGS)
+        {
+            printf(M_ERR_STD_RNG);
+            break;
+        }
+
+        rc = update_student(sharded ? shard_fd(&shards, id) : fd, id, argv[3], argv[4], gpa);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'F':
+        //    arv[0]  arv[1]  arv[2]
+        // prog_name -follow  [lsn]
+        //-------------------------
+        // example:  prog_name -follow 1
+        if (argc > 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = follow_changes(argc == 3 ? strtoull(argv[2], NULL, 10) : 0);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'S':
+        //    arv[0] arv[1] arv[2]  arv[3...]
+        // prog_name -shard      n  [dir ...]
+        //-----------------------------------
+        // example:  prog_name -shard 4 /mnt/d1 /mnt/d2
+        if (argc < 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = create_shards(fd, atoi(argv[2]), argv + 3, argc - 3);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'I':
+        //    arv[0]  arv[1]    arv[2]
+        // prog_name -import  other_db
+        //----------------------------
+        // example:  prog_name -import dept.db
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = import_file(argv[2], fd, sharded ? &shards : NULL, &import_stats);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'D':
+        //    arv[0]    arv[1] arv[2]        arv[3...]
+        // prog_name -distinct column  [other.hll ...]
+        //--------------------------------------------
+        // example:  prog_name -distinct lname ../math/student.hll
+        if (argc < 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = print_distinct(fd, sharded ? &shards : NULL, argv[2], argv + 3, argc - 3);
+        if (rc == ERR_DB_OP)
+            exit_code = EXIT_FAIL_ARGS;
+        else if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'q':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -q   query
+        //-------------------------
+        // example:  prog_name -q 'gpa>=350 and lname^="Sm"'
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (compile_query(argv[2], &query) != NO_ERROR)
+        {
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = sharded ? query_shards(&shards, &query) : query_db(fd, &query);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
@@ -688,13 +2821,17 @@ int main(int argc, char *argv[])
         //       and reopen db indicating truncate=true
         close(fd);
         fd = open_db(DB_FILE, true);
-        if (fd < 0)
+        if (fd < 0 || (sharded && zero_shards(&shards) != NO_ERROR))
         {
             exit_code = EXIT_FAIL_DB;
             break;
         }
         printf(M_DB_ZERO_OK);
         exit_code = EXIT_OK;
+        hll_init(&empty_hll);
+        hll_save(HLL_FILE, &empty_hll);
+        if (cdc_append(CDC_OP_ZERO, &EMPTY_STUDENT_RECORD) != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
         break;
     default:
         usage(argv[0]);
@@ -703,6 +2840,8 @@ int main(int argc, char *argv[])
 
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
+    if (sharded)
+        close_shard_map(&shards);
     close(fd);
     exit(exit_code);
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #ifndef __SDB_H__
 
+#include <limits.h>
+
 #include "db.h" //get student record type
 
 //prototypes for functions go below for this assignment
@@ -7,6 +9,7 @@ int open_db(char *dbFile, bool should_truncate);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
 int del_student(int fd, int id);
+int update_student(int fd, int id, char *fname, char *lname, int gpa);
 int compress_db(int fd);
 void print_student(student_t *s);
 int validate_range(int id, int gpa);
@@ -14,15 +17,157 @@ int count_db_records(int fd);
 int print_db(int fd);
 void usage(char *);
 
+//scan engine - reads the db in large batches and hands the live (non-empty)
+//records of each batch to a callback.  A callback returns NO_ERROR to keep
+//scanning, a positive value to stop early or a negative error code.
+#define SCAN_BATCH_RECORDS  1024
+typedef int (*scan_fn_t)(student_t *batch, int n, void *ctx);
+int scan_db(int fd, int start_id, int end_id, scan_fn_t fn, void *ctx);
+
+//predicate filter engine - a query such as 'gpa>=350 and lname^="Sm"' is
+//compiled into a small program of terms that is evaluated a batch at a time.
+//Terms joined by "and" form a group, groups are joined by "or".
+#define QUERY_MAX_TERMS     16
+
+#define Q_FLD_ID        0
+#define Q_FLD_GPA       1
+#define Q_FLD_FNAME     2
+#define Q_FLD_LNAME     3
+
+#define Q_OP_EQ         0   // =  or ==
+#define Q_OP_NE         1   // !=
+#define Q_OP_LT         2   // <
+#define Q_OP_LE         3   // <=
+#define Q_OP_GT         4   // >
+#define Q_OP_GE         5   // >=
+#define Q_OP_PREFIX     6   // ^=  (names only)
+
+typedef struct query_term {
+    int field;          // Q_FLD_xxx
+    int op;             // Q_OP_xxx
+    int num;            // operand for id/gpa terms
+    int str_len;        // operand length for name terms
+    char str[32];       // operand for name terms, sized for the widest field
+    int starts_group;   // term follows an "or"
+} query_term_t;
+
+typedef struct query {
+    int nterms;
+    query_term_t terms[QUERY_MAX_TERMS];
+} query_t;
+
+int compile_query(const char *text, query_t *q);
+int query_db(int fd, query_t *q);
+
+//change data capture - every successful change to the db appends one fixed
+//size binary record to CDC_FILE.  When the log reaches CDC_MAX_BYTES it is
+//rotated to CDC_FILE.1 (older logs shift up, up to CDC_KEEP_FILES of them).
+//The lsn is a log sequence number that keeps increasing across rotations.
+#define CDC_OP_ADD      1
+#define CDC_OP_DEL      2   // student holds the record that was deleted
+#define CDC_OP_UPD      3
+#define CDC_OP_ZERO     4   // all records removed, student is empty
+
+#define CDC_MAX_BYTES   (1024 * 1024)
+#define CDC_KEEP_FILES  4
+
+typedef struct cdc_record {
+    unsigned long long lsn;
+    int op;
+    int reserved;       // pads the record to 80 bytes
+    student_t student;
+} cdc_record_t;
+
+int cdc_append(int op, const student_t *s);
+int cdc_append_many(int op, const student_t *s, int n);
+int follow_changes(unsigned long long from_lsn);
+
+//range sharding - the db can be split into up to SHARD_MAX files, each one
+//holding a contiguous range of ids.  A shard is an ordinary db file that
+//keeps every record at the usual id * STUDENT_RECORD_SIZE offset (the
+//part of the file before its range is a hole), so all of the single file
+//functions work on a shard fd unchanged.  The shards are listed in
+//SHARD_MANIFEST, one "lo hi path" line per shard with hi exclusive, and
+//may live in different directories or on different mount points.
+#define SHARD_MAX       16
+
+typedef struct shard {
+    int lo;             // first id held by the shard
+    int hi;             // one past the last id held by the shard
+    int fd;
+    char path[PATH_MAX];
+} shard_t;
+
+typedef struct shard_map {
+    int nshards;
+    shard_t shards[SHARD_MAX];
+} shard_map_t;
+
+int load_shard_map(shard_map_t *map);
+void close_shard_map(shard_map_t *map);
+int shard_fd(shard_map_t *map, int id);
+int create_shards(int fd, int nshards, char **dirs, int ndirs);
+int scan_shards(shard_map_t *map, scan_fn_t fn, void **ctxs);
+int count_shard_records(shard_map_t *map);
+int print_shards(shard_map_t *map);
+int query_shards(shard_map_t *map, query_t *q);
+int zero_shards(shard_map_t *map);
+
+//cursor paging - returns students in id order a page at a time, the cursor
+//is the id to start the next page at
+#define PAGE_DEFAULT_LIMIT  50
+int scan_page(int fd, shard_map_t *map, int from_id, int limit, student_t *out, int *next_id);
+int print_page(int fd, shard_map_t *map, int from_id, int limit);
+
+//distinct counting - a HyperLogLog sketch per name column estimates how many
+//distinct values the column holds in HLL_REGISTERS bytes.  The standard
+//error of an estimate is 1.04 / sqrt(HLL_REGISTERS), about 1.6%.  Sketches
+//merge by taking the max of each register, so the sketch of a set of dbs is
+//the merge of their sketches.
+#define HLL_PRECISION   12
+#define HLL_REGISTERS   (1 << HLL_PRECISION)
+
+#define HLL_COL_FNAME   0
+#define HLL_COL_LNAME   1
+#define HLL_COL_NAME    2   // first and last name pair
+#define HLL_COLUMNS     3
+
+typedef struct hll {
+    char magic[4];      // "HLL1"
+    int stale;          // students were deleted or changed since the rebuild
+    unsigned char regs[HLL_COLUMNS][HLL_REGISTERS];
+} hll_t;
+
+void hll_init(hll_t *h);
+void hll_add_students(hll_t *h, const student_t *s, int n);
+void hll_merge(hll_t *dst, const hll_t *src);
+double hll_estimate(const hll_t *h, int column);
+int hll_load(const char *path, hll_t *h);
+int hll_save(const char *path, const hll_t *h);
+int hll_record_students(const student_t *s, int n);
+int hll_mark_stale(void);
+int print_distinct(int fd, shard_map_t *map, char *column, char **extra, int nextra);
+
+//import - merges another db file into this one, see import_db()
+typedef struct import_stats {
+    int imported;       // students copied in
+    int conflicts;      // students skipped because the id was taken
+} import_stats_t;
+
+int import_db(int fd, int src_fd, int start_id, int end_id, import_stats_t *stats);
+int import_file(char *src_path, int fd, shard_map_t *map, import_stats_t *stats);
+
 //error codes to be returned from individual functions
 // NO_ERROR is returned if there are no errors
 // ERR_DB_FILE is returned if there is are any issues with the database file itself
 // ERR_DB_OP is returned if an operation did not work aka add or delete a student
 // SRCH_NOT_FOUND is returned if the student is not found (get_student, and del_student)
+// ERR_QUERY is returned if a query string could not be compiled
 #define NO_ERROR        0
 #define ERR_DB_FILE     -1
 #define ERR_DB_OP       -2
 #define SRCH_NOT_FOUND  -3
+#define ERR_QUERY       -4
 #define NOT_IMPLEMENTED_YET 0
 
 
@@ -53,6 +198,24 @@ void usage(char *);
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_ERR_CDC_WRITE   "Error writing change log, replicas may be stale!\n"
+#define M_ERR_CDC_FOLLOW  "Error following change log, exiting!\n"
+#define M_STD_UPDATED     "Student %d updated in database.\n"
+#define M_ERR_SHARD_MAP   "Error reading shard manifest, exiting!\n"
+#define M_ERR_SHARD_CNT   "Shard count must be between 1 and %d.\n"
+#define M_ERR_SHARD_EXIST "Database is already sharded.\n"
+#define M_DB_SHARDED_OK   "Database split into %d shard(s).\n"
+#define M_ERR_IMPORT_SELF "Cant import a database into itself.\n"
+#define M_DB_IMPORTED     "Imported %d student record(s), %d conflict(s) skipped.\n"
+#define M_PAGE_NEXT       "Next cursor: --from %d\n"
+#define M_PAGE_END        "End of database.\n"
+#define M_ERR_HLL_COLUMN  "Unknown column %s, use fname, lname or name.\n"
+#define M_ERR_HLL_READ    "Error reading sketch file %s.\n"
+#define M_HLL_DISTINCT    "Approximately %.0f distinct %s value(s) (+/- %.1f%%).\n"
+#define M_HLL_STALE       "Students were removed since the last full scan, run -c to refresh.\n"
+#define M_ERR_QUERY       "Invalid query near: %s\n"
+#define M_QUERY_NO_MATCH  "No student records matched the query.\n"
+#define M_QUERY_MATCH_CNT "%d student record(s) matched the query.\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
@@ -61,4 +224,7 @@ void usage(char *);
 #define  STUDENT_PRINT_HDR_STRING   "%-6s %-24s %-32s %-3s\n"
 #define  STUDENT_PRINT_FMT_STRING   "%-6d %-24.24s %-32.32s %-3.2f\n"
 
+//format for change records printed by -follow:  lsn op id fname lname gpa
+#define  CDC_PRINT_FMT_STRING       "%llu %s %d %.24s %.32s %d\n"
+
 #endif
\ No newline at end of file
@@ -0,0 +1,45 @@
+#!/usr/bin/env bats
+
+# File: student_tests.sh
+# 
+# Create your unit tests suit in this file
+
+setup() {
+    gcc -O2 -o sdbsc sdbsc.c
+    # keep student.db and its side files out of the source directory
+    TEST_DIR=$(mktemp -d)
+    SDBSC="$PWD/sdbsc"
+    cd "$TEST_DIR"
+}
+
+teardown() {
+    cd - > /dev/null
+    rm -rf "$TEST_DIR" sdbsc
+}
+
+@test "Query with QUERY_MAX_TERMS terms runs" {
+    "$SDBSC" -a 16 tom smith 300
+    query="id=1"
+    for i in $(seq 2 16); do query="$query or id=$i"; done
+
+    run "$SDBSC" -q "$query"
+
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [[ "$output" =~ "1 student record(s) matched the query." ]]
+    [ "$status" -eq 0 ]
+}
+
+@test "Query with one term too many is rejected" {
+    query="id=1"
+    for i in $(seq 2 16); do query="$query or id=$i"; done
+
+    run "$SDBSC" -q "$query or id=99"
+
+    echo "Output: $output"
+    echo "Exit Status: $status"
+
+    [ "$output" = "Invalid query near: or id=99" ]
+    [ "$status" -eq 2 ]
+}
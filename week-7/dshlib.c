@@ -7,6 +7,11 @@
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <spawn.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <signal.h>
 
 #include "dshlib.h"
 
@@ -16,8 +21,36 @@ typedef struct {
     char **args;
 } Command;
 
+// launchbench defaults
+#define BENCH_DEF_RUNS  1000
+#define BENCH_CMD       "/bin/true"
+
+// Buckets in the command path cache
+#define PATH_HASH_BUCKETS 64
+
+extern char **environ;
+
 int last_status = 0; // To store the last command's return code
 
+// Backing store for the parse arena, nothing in it outlives one command line
+static char cmd_arena_mem[CMD_ARENA_SZ];
+static cmd_arena_t cmd_arena = { cmd_arena_mem, 0, CMD_ARENA_SZ };
+
+// Function to carve bytes out of an arena, returns NULL once it is full
+char *arena_alloc(cmd_arena_t *arena, size_t size) {
+    if (size > arena->size - arena->used) {
+        return NULL;
+    }
+    char *mem = arena->base + arena->used;
+    arena->used += size;
+    return mem;
+}
+
+// Function to drop everything parsed from the last command line at once
+void reset_cmd_arena(void) {
+    cmd_arena.used = 0;
+}
+
 // Function to allocate memory for command buffer
 int alloc_cmd_buff(cmd_buff_t *cmd_buff) {
     cmd_buff->_cmd_buffer = malloc(SH_CMD_MAX * sizeof(char));
@@ -39,6 +72,9 @@ int clear_cmd_buff(cmd_buff_t *cmd_buff) {
     for (int i = 0; i < CMD_ARGV_MAX; i++) {
         cmd_buff->argv[i] = NULL;
     }
+    cmd_buff->input_file = NULL;
+    cmd_buff->output_file = NULL;
+    cmd_buff->append_mode = false;
     return OK;
 }
 
@@ -66,152 +102,385 @@ char *trim_whitespace(char *str) {
     return str;
 }
 
-int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
-    cmd_buff->argc = 0;
-    cmd_buff->input_redirect = 0;
-    cmd_buff->output_redirect = 0;
-    cmd_buff->input_fd = -1;
-    cmd_buff->output_fd = -1;
-
-    char *token = cmd_line;
-    int in_quotes = 0;  // Flag to track if we're inside quotes
-    char *start = NULL;
-
-    // Trim leading whitespace
-    trim_whitespace(token);
-
-    while (*token != '\0' && cmd_buff->argc < CMD_ARGV_MAX) {
-        // Skip leading whitespace unless we're inside quotes
-        if (isspace((unsigned char)*token) && !in_quotes) {
-            token++;
-            continue;
-        }
+// Function to tell the characters that end an unquoted word
+static int is_word_end(char c) {
+    return c == '\0' || isspace((unsigned char)c) ||
+           c == PIPE_CHAR || c == '<' || c == '>';
+}
 
-        // Handle input redirection
-        if (*token == '<' && !in_quotes) {
-            token++;  // Skip the '<' symbol
-            trim_whitespace(token);
-            if (*token == '\0') {
-                return ERR_CMD_ARGS_BAD;  // No file provided after '<'
+// Function to copy the word at *pos to *out without its quotes, a quoted
+// part can hold spaces, pipes and redirections.  Moves both past the word.
+static char *scan_word(char **pos, char **out) {
+    char *p = *pos;
+    char *word = *out;
+    char *w = word;
+    char quote = 0;
+
+    while (*p != '\0' && (quote || !is_word_end(*p))) {
+        if (quote) {
+            if (*p == quote) {
+                quote = 0;
+            } else {
+                *w++ = *p;
             }
+        } else if (*p == '"' || *p == '\'') {
+            quote = *p;
+        } else {
+            *w++ = *p;
+        }
+        p++;
+    }
+    *w++ = '\0';
 
-            cmd_buff->input_redirect = 1;
-            char *file = token;
-            // Get the filename
-            while (*token != '\0' && !isspace((unsigned char)*token)) {
-                token++;
-            }
-            int file_len = token - file;
-            char *input_file = malloc(file_len + 1);
-            strncpy(input_file, file, file_len);
-            input_file[file_len] = '\0';
-
-            cmd_buff->input_fd = open(input_file, O_RDONLY);
-            if (cmd_buff->input_fd == -1) {
-                perror("Failed to open input file");
-                return ERR_EXEC_CMD;
-            }
+    *pos = p;
+    *out = w;
+    return word;
+}
 
-            free(input_file);
-            continue;
+// Function to split a command line into its whole pipeline in one pass.
+// Every stage gets its argv and redirection files, and every word is
+// copied out without quotes into one arena block.  The block needs no
+// more than the length of the line plus one, since each word's '\0'
+// takes the place of the character that ended it.
+int build_cmd_list(char *cmd_line, command_list_t *clist) {
+    char *out = arena_alloc(&cmd_arena, strlen(cmd_line) + 1);
+    char *p = cmd_line;
+    cmd_buff_t *cmd;
+
+    memset(clist, 0, sizeof(*clist));
+    if (out == NULL) {
+        printf(CMD_ERR_TOO_BIG);
+        return ERR_CMD_TOO_BIG;
+    }
+
+    clist->num = 1;
+    cmd = &clist->commands[0];
+    while (1) {
+        while (isspace((unsigned char)*p)) {
+            p++;
         }
 
-        // Handle output redirection
-        if (*token == '>' && !in_quotes) {
-            token++;  // Skip the '>' symbol
-            if (*token == '>') {  // Check for append redirection '>>'
-                cmd_buff->output_redirect = 2;  // 2 means append mode
-                token++;  // Skip the second '>'
-            } else {
-                cmd_buff->output_redirect = 1;  // 1 means overwrite mode
+        // End of a stage
+        if (*p == '\0' || *p == PIPE_CHAR) {
+            if (cmd->argc == 0) {
+                // A line with nothing on it is only a warning, one with just
+                // a redirection has no command to redirect
+                if (*p == '\0' && clist->num == 1) {
+                    if (cmd->input_file == NULL && cmd->output_file == NULL) {
+                        clist->num = 0;
+                        printf(CMD_WARN_NO_CMD);
+                        return WARN_NO_CMDS;
+                    }
+                    printf(CMD_ERR_NO_CMD);
+                    return ERR_CMD_ARGS_BAD;
+                }
+                printf(CMD_ERR_EMPTY_PIPE);
+                return ERR_CMD_ARGS_BAD;
             }
-            token++;  // Skip space
-            trim_whitespace(token);
-            if (*token == '\0') {
-                return ERR_CMD_ARGS_BAD;  // No file provided after '>'
+            cmd->argv[cmd->argc] = NULL;
+            if (*p == '\0') {
+                return OK;
             }
-
-            char *file = token;
-            // Get the filename
-            while (*token != '\0' && !isspace((unsigned char)*token)) {
-                token++;
+            if (clist->num == CMD_MAX) {
+                printf(CMD_ERR_PIPE_LIMIT, CMD_MAX);
+                return ERR_TOO_MANY_COMMANDS;
             }
-            int file_len = token - file;
-            char *output_file = malloc(file_len + 1);
-            strncpy(output_file, file, file_len);
-            output_file[file_len] = '\0';
+            cmd = &clist->commands[clist->num++];
+            p++;
+            continue;
+        }
 
-            // Trim any additional spaces just in case
-            trim_whitespace(output_file);
+        // Handle input and output redirection, the file name is the next word
+        if (*p == '<' || *p == '>') {
+            char op = *p++;
+            bool append = false;
 
-            if (cmd_buff->output_redirect == 1) {
-                cmd_buff->output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            } else {
-                cmd_buff->output_fd = open(output_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            if (op == '>' && *p == '>') {
+                append = true;
+                p++;
             }
-
-            if (cmd_buff->output_fd == -1) {
-                perror("Failed to open output file");
-                return ERR_EXEC_CMD;
+            while (isspace((unsigned char)*p)) {
+                p++;
+            }
+            if (is_word_end(*p)) {
+                printf(CMD_ERR_REDIRECT);
+                return ERR_CMD_ARGS_BAD;
             }
 
-            free(output_file);
+            char *file = scan_word(&p, &out);
+            if (op == '<') {
+                cmd->input_file = file;
+            } else {
+                cmd->output_file = file;
+                cmd->append_mode = append;
+            }
             continue;
         }
 
-        // Process the token (start of a new token)
-        if (start == NULL) {
-            start = token;
+        // Anything else is the next argument, argv keeps one slot for NULL
+        if (cmd->argc == CMD_ARGV_MAX - 1) {
+            printf(CMD_ERR_ARGS_LIMIT, CMD_ARGV_MAX - 1);
+            return ERR_CMD_OR_ARGS_TOO_BIG;
         }
+        cmd->argv[cmd->argc++] = scan_word(&p, &out);
+    }
+}
 
-        // Move token to the next space or quote, but keep inside quoted sections
-        while (*token != '\0' && (in_quotes || !isspace((unsigned char)*token))) {
-            if (*token == '"') {
-                in_quotes = !in_quotes;  // Toggle the in_quotes flag when encountering a quote
-            }
-            token++;
+// Function to parse a line holding a single command, it goes through the
+// same tokenizer as a pipeline does
+int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff) {
+    command_list_t clist;
+    char *buffer = cmd_buff->_cmd_buffer;
+
+    int rc = build_cmd_list(cmd_line, &clist);
+    if (rc != OK) {
+        return rc;
+    }
+    if (clist.num > 1) {
+        return ERR_TOO_MANY_COMMANDS;
+    }
+
+    *cmd_buff = clist.commands[0];
+    cmd_buff->_cmd_buffer = buffer;
+    return OK;
+}
+
+// COMMAND PATH CACHE
+//
+// execvp() walks $PATH and tries every directory until one exec works.
+// Instead a command's full path is looked up once and kept in a hash
+// table, and launches exec that path directly.  The table is thrown away
+// when PATH is not the one it was filled from.  The hash built in shows,
+// clears and fills it.
+
+typedef struct path_entry {
+    struct path_entry *next;
+    int hits;
+    char *name;
+    char *path;
+} path_entry_t;
+
+static path_entry_t *path_hash[PATH_HASH_BUCKETS];
+static char *path_hash_env;     // PATH the table was filled from
+
+// Function to hash a command name (FNV-1a)
+static unsigned hash_name(const char *name) {
+    unsigned h = 2166136261u;
+    while (*name != '\0') {
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    }
+    return h % PATH_HASH_BUCKETS;
+}
+
+// Function to empty the command path cache
+void clear_cmd_hash(void) {
+    for (int i = 0; i < PATH_HASH_BUCKETS; i++) {
+        while (path_hash[i] != NULL) {
+            path_entry_t *e = path_hash[i];
+            path_hash[i] = e->next;
+            free(e);
         }
+    }
+    free(path_hash_env);
+    path_hash_env = NULL;
+}
 
-        // If we have a complete token (non-empty)
-        if (start != NULL && token != start) {
-            int token_length = token - start;
+// Function to drop the cache if PATH changed since it was filled
+static void check_path_change(void) {
+    const char *path = getenv("PATH");
+    if (path == NULL) {
+        path = "";
+    }
+    if (path_hash_env != NULL && strcmp(path_hash_env, path) == 0) {
+        return;
+    }
+    clear_cmd_hash();
+    path_hash_env = strdup(path);
+}
 
-            // If the token ends with a quote (and we're outside quotes), remove it
-            if (token_length > 0 && *(token - 1) == '"') {
-                token_length--;  // Remove the quote at the end
-            }
+// Function to walk PATH for an executable called name, returns 0 with the
+// full path in buf or the errno execvp would have given
+static int search_path(const char *name, char *buf, size_t size) {
+    const char *dir = path_hash_env != NULL ? path_hash_env : "";
+    int err = ENOENT;
+    struct stat sb;
 
-            // If the token starts with a quote, remove it
-            if (token_length > 0 && *start == '"') {
-                start++;  // Skip the starting quote
-                token_length--;  // Decrease the token length
+    while (1) {
+        const char *end = strchr(dir, ':');
+        int dir_len = end != NULL ? end - dir : (int)strlen(dir);
+
+        // An empty PATH entry means the current directory
+        int n = dir_len == 0 ? snprintf(buf, size, "./%s", name)
+                             : snprintf(buf, size, "%.*s/%s", dir_len, dir, name);
+        if (n > 0 && (size_t)n < size && stat(buf, &sb) == 0 && S_ISREG(sb.st_mode)) {
+            if (access(buf, X_OK) == 0) {
+                return 0;
             }
+            err = EACCES;
+        }
 
-            char *arg = malloc(token_length + 1);
-            if (arg == NULL) {
-                return ERR_MEMORY;
-            }
+        if (end == NULL) {
+            return err;
+        }
+        dir = end + 1;
+    }
+}
 
-            // Copy the token (argument) into a newly allocated string
-            strncpy(arg, start, token_length);
-            arg[token_length] = '\0';
+// Function to find name in the cache, looking it up and adding it on a
+// miss.  Returns NULL with errno set if there is no such command.
+static path_entry_t *hash_cmd(const char *name) {
+    unsigned h;
+    path_entry_t *e;
+    char buf[PATH_MAX];
+
+    check_path_change();
+    h = hash_name(name);
+    for (e = path_hash[h]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
 
-            // Store the argument in the command buffer
-            cmd_buff->argv[cmd_buff->argc++] = arg;
+    int err = search_path(name, buf, sizeof(buf));
+    if (err != 0) {
+        errno = err;
+        return NULL;
+    }
 
-            // Reset start for the next token
-            start = NULL;
+    // The entry, its name and its path are one allocation
+    size_t name_len = strlen(name) + 1;
+    e = malloc(sizeof(*e) + name_len + strlen(buf) + 1);
+    if (e == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    e->hits = 0;
+    e->name = (char *)(e + 1);
+    e->path = e->name + name_len;
+    strcpy(e->name, name);
+    strcpy(e->path, buf);
+    e->next = path_hash[h];
+    path_hash[h] = e;
+    return e;
+}
+
+// Function to forget one command, used when its cached path went stale
+static void forget_cmd_path(const char *name) {
+    path_entry_t **link = &path_hash[hash_name(name)];
+
+    while (*link != NULL) {
+        if (strcmp((*link)->name, name) == 0) {
+            path_entry_t *e = *link;
+            *link = e->next;
+            free(e);
+            return;
         }
+        link = &(*link)->next;
+    }
+}
+
+// Function to get the path to exec for a command, a name with a '/' in it
+// is used as it is.  Returns NULL with errno set if there is none.
+const char *find_cmd_path(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
 
-        // Skip any trailing whitespace after a token (outside quotes)
-        while (*token != '\0' && isspace((unsigned char)*token) && !in_quotes) {
-            token++;
+    path_entry_t *e = hash_cmd(name);
+    if (e == NULL) {
+        return NULL;
+    }
+    e->hits++;
+    return e->path;
+}
+
+// Function for the hash built in: no arguments lists the cache, -r
+// empties it and command names are looked up and added to it
+static void hash_builtin(cmd_buff_t *cmd) {
+    if (cmd->argc == 1) {
+        bool empty = true;
+
+        check_path_change();
+        for (int i = 0; i < PATH_HASH_BUCKETS; i++) {
+            for (path_entry_t *e = path_hash[i]; e != NULL; e = e->next) {
+                if (empty) {
+                    printf("hits\tcommand\n");
+                    empty = false;
+                }
+                printf("%4d\t%s\n", e->hits, e->path);
+            }
+        }
+        if (empty) {
+            printf("hash: hash table empty\n");
         }
+        return;
     }
 
-    cmd_buff->argv[cmd_buff->argc] = NULL;  // Null-terminate the arguments
+    if (strcmp(cmd->argv[1], "-r") == 0) {
+        clear_cmd_hash();
+        return;
+    }
 
-    return OK;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (strchr(cmd->argv[i], '/') == NULL && hash_cmd(cmd->argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", cmd->argv[i]);
+        }
+    }
+}
+
+// Function to time launching a do-nothing command by fork+exec and by
+// posix_spawn.  Given a size in MB the shell first dirties that much
+// memory, whose page tables fork has to copy on every launch.
+static void launch_bench(cmd_buff_t *cmd) {
+    int runs = cmd->argc > 1 ? atoi(cmd->argv[1]) : BENCH_DEF_RUNS;
+    size_t mb = cmd->argc > 2 ? strtoul(cmd->argv[2], NULL, 10) : 0;
+    char bench_cmd[] = BENCH_CMD;
+    char *argv[] = { bench_cmd, NULL };
+    char *ballast = NULL;
+
+    if (runs <= 0) {
+        runs = BENCH_DEF_RUNS;
+    }
+    if (mb > 0) {
+        ballast = malloc(mb << 20);
+        if (ballast == NULL) {
+            fprintf(stderr, "launchbench: out of memory\n");
+            return;
+        }
+        memset(ballast, 1, mb << 20);
+    }
+
+    for (int way = 0; way < 2; way++) {
+        struct timespec start, end;
+        int done = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (; done < runs; done++) {
+            pid_t pid;
+
+            if (way == 0) {
+                pid = fork();
+                if (pid == 0) {
+                    execv(argv[0], argv);
+                    _exit(127);
+                }
+            } else if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+                pid = -1;
+            }
+            if (pid == -1) {
+                perror("launchbench");
+                break;
+            }
+            waitpid(pid, NULL, 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        printf("%-12s %d launches, %.1f us each\n",
+               way == 0 ? "fork+exec" : "posix_spawn", done, done > 0 ? us / done : 0.0);
+    }
+
+    free(ballast);
 }
 
 // Function to execute built-in commands
@@ -247,105 +516,344 @@ Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd) {
         return ERR_CMD_ARGS_BAD;  
     }
 
+    // Handle the hash command, shows, clears or fills the command path cache
+    if (strcmp(cmd->argv[0], "hash") == 0) {
+        hash_builtin(cmd);
+        return BI_EXECUTED;
+    }
+
+    // Handle the launchbench command, times fork+exec against posix_spawn
+    if (strcmp(cmd->argv[0], "launchbench") == 0) {
+        launch_bench(cmd);
+        return BI_EXECUTED;
+    }
+
     // Handle other built-in commands (like 'which', etc.)
     return BI_NOT_BI; // Return this for non-built-in commands
 }
 
-int build_cmd_list(char *cmd_line, command_list_t *clist) {
-    memset(clist->commands, 0, sizeof(clist->commands));
-    char *cmd_token;
-    char *command_copy = strdup(cmd_line);  // Make a copy of the input command line for strtok
-    int cmd_count = 0;
+// Function to release a parsed command list, its strings live in the arena
+int free_cmd_list(command_list_t *cmd_lst) {
+    cmd_lst->num = 0;
+    reset_cmd_arena();
+    return OK;
+}
+
+// Function to print why a command could not be started, returns the exit
+// code the shell reports for it
+static int launch_error(int err) {
+    switch (err) {
+        case ENOENT:
+            fprintf(stderr, "Command not found in PATH\n");
+            return 2;
+        case EACCES:
+            fprintf(stderr, "Permission denied\n");
+            return 13;
+        default:
+            fprintf(stderr, "Failed to execute command: %s\n", strerror(err));
+            return 1;
+    }
+}
 
-    trim_whitespace(command_copy);
+// Function to open a command's redirection files close-on-exec, so they
+// only reach the child through the dup2 file actions in spawn_cmd()
+static int open_redirects(cmd_buff_t *cmd, int *in_fd, int *out_fd) {
+    *in_fd = -1;
+    *out_fd = -1;
 
-    // If the command is empty, return a warning
-    if (command_copy[0] == '\0') {
-        printf("warning: no commands provided\n");
-        free(command_copy);
-        return WARN_NO_CMDS;
+    if (cmd->input_file != NULL) {
+        *in_fd = open(cmd->input_file, O_RDONLY | O_CLOEXEC);
+        if (*in_fd == -1) {
+            perror("Failed to open input file");
+            return ERR_EXEC_CMD;
+        }
     }
 
-    // Split the input line by the pipe character '|'
-    cmd_token = strtok(command_copy, PIPE_STRING); // Split by pipe
-    while (cmd_token != NULL) {
-        if (cmd_count >= CMD_MAX) {
-            free(command_copy);
-            return ERR_TOO_MANY_COMMANDS;
+    if (cmd->output_file != NULL) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (cmd->append_mode ? O_APPEND : O_TRUNC);
+        *out_fd = open(cmd->output_file, flags, 0644);
+        if (*out_fd == -1) {
+            perror("Failed to open output file");
+            if (*in_fd != -1) {
+                close(*in_fd);
+            }
+            return ERR_EXEC_CMD;
         }
+    }
+
+    return OK;
+}
 
-        // Trim whitespace from the command
-        trim_whitespace(cmd_token);
+// Function to start one command with posix_spawn.  The shell is never
+// forked, so launching stays cheap however big the shell grows.  stdin
+// and stdout are wired up by file actions, -1 leaves them alone.  The
+// program comes from the path cache and is exec'd without a PATH walk.
+// Returns 0 or the errno of the failed launch.
+static int spawn_cmd(cmd_buff_t *cmd, int in_fd, int out_fd, pid_t *pid) {
+    posix_spawn_file_actions_t actions;
+    int rc = posix_spawn_file_actions_init(&actions);
+    if (rc != 0) {
+        return rc;
+    }
 
-        if (strlen(cmd_token) == 0) {
-            printf("Error: Empty command in pipeline!\n");
-            free(command_copy);
-            return ERR_MEMORY;
+    if (in_fd != -1) {
+        rc = posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (rc == 0 && out_fd != -1) {
+        rc = posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (rc == 0) {
+        const char *path = find_cmd_path(cmd->argv[0]);
+        rc = path != NULL ? posix_spawn(pid, path, &actions, NULL, cmd->argv, environ) : errno;
+
+        // The program may have moved since it was cached, look once more
+        if (rc == ENOENT && path != NULL && path != cmd->argv[0]) {
+            forget_cmd_path(cmd->argv[0]);
+            path = find_cmd_path(cmd->argv[0]);
+            rc = path != NULL ? posix_spawn(pid, path, &actions, NULL, cmd->argv, environ) : errno;
         }
+    }
 
-        // Tokenize the current command into executable and arguments
-        char *exe_token = cmd_token;
-        char *args_token = NULL;
+    posix_spawn_file_actions_destroy(&actions);
+    return rc;
+}
 
-        // Move exe_token to the first space or end of string
-        while (*exe_token != '\0' && !isspace(*exe_token)) {
-            exe_token++;  
+// FORK-FREE BUILT INS
+//
+// echo, pwd, true, false and test are common enough in scripts that
+// starting a process for each one costs more than the command itself.
+// They are looked up in a small registry and run inside the shell, with
+// stdout swapped onto the redirection file or pipe for the length of the
+// call.  They write with write() rather than stdio, so their output goes
+// out just like a child's would and never mixes with the shell's own
+// buffered prompt.
+
+// Function to write all of a buffer to stdout
+static int write_out(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
         }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
 
-        if (*exe_token == '\0') {
-            // If no space is found, the entire string is the executable
-            clist->commands[cmd_count].argv[0] = strdup(cmd_token);
-            clist->commands[cmd_count].argc = 1;
-        } else {
-            // Otherwise, split the string into executable and arguments
-            *exe_token = '\0';  // Null-terminate the executable
-            clist->commands[cmd_count].argv[0] = strdup(cmd_token);
-            clist->commands[cmd_count].argc = 1;
-
-            // Move to the argument string (skipping spaces)
-            args_token = exe_token + 1;
-            trim_whitespace(args_token);
-
-            if (args_token[0] != '\0') {
-                // Tokenize the remaining arguments by spaces
-                char *arg_token = strtok(args_token, " ");
-                while (arg_token != NULL) {
-                    if (clist->commands[cmd_count].argc < CMD_ARGV_MAX) {
-                        clist->commands[cmd_count].argv[clist->commands[cmd_count].argc] = strdup(arg_token);
-                        clist->commands[cmd_count].argc++;
-                    }
-                    arg_token = strtok(NULL, " ");
-                }
-            }
+static int bi_echo(cmd_buff_t *cmd) {
+    // The arguments all came out of one command line, so they fit
+    static char buf[CMD_ARENA_SZ + 1];
+    bool newline = true;
+    size_t len = 0;
+    int first = 1;
+
+    if (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) {
+        newline = false;
+        first = 2;
+    }
+    for (int i = first; i < cmd->argc; i++) {
+        size_t n = strlen(cmd->argv[i]);
+        if (len + n + 2 > sizeof(buf)) {
+            break;
+        }
+        if (i > first) {
+            buf[len++] = SPACE_CHAR;
         }
+        memcpy(buf + len, cmd->argv[i], n);
+        len += n;
+    }
+    if (newline) {
+        buf[len++] = '\n';
+    }
+    return write_out(buf, len) == 0 ? 0 : 1;
+}
 
-        // NULL terminate the argv array
-        clist->commands[cmd_count].argv[clist->commands[cmd_count].argc] = NULL;
+static int bi_pwd(cmd_buff_t *cmd) {
+    char buf[PATH_MAX + 1];
+    (void)cmd;
 
+    if (getcwd(buf, PATH_MAX) == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    size_t len = strlen(buf);
+    buf[len++] = '\n';
+    return write_out(buf, len) == 0 ? 0 : 1;
+}
 
-        cmd_count++;
+static int bi_true(cmd_buff_t *cmd) {
+    (void)cmd;
+    return 0;
+}
 
-        // Move to the next command segment after the pipe
-        cmd_token = strtok(NULL, PIPE_STRING);
+static int bi_false(cmd_buff_t *cmd) {
+    (void)cmd;
+    return 1;
+}
 
-        // After strtok, skip any leading spaces in the next segment
-        if (cmd_token != NULL) {
-            while (*cmd_token == SPACE_CHAR) {
-                cmd_token++;  
+// Function to evaluate test's one-operand checks, 2 means a bad operator
+static int test_unary(const char *name, const char *op, const char *arg) {
+    struct stat sb;
+
+    if (strcmp(op, "-n") == 0) return arg[0] != '\0' ? 0 : 1;
+    if (strcmp(op, "-z") == 0) return arg[0] == '\0' ? 0 : 1;
+    if (strcmp(op, "-r") == 0) return access(arg, R_OK) == 0 ? 0 : 1;
+    if (strcmp(op, "-w") == 0) return access(arg, W_OK) == 0 ? 0 : 1;
+    if (strcmp(op, "-x") == 0) return access(arg, X_OK) == 0 ? 0 : 1;
+    if (strcmp(op, "-e") == 0 || strcmp(op, "-f") == 0 ||
+        strcmp(op, "-d") == 0 || strcmp(op, "-s") == 0) {
+        if (stat(arg, &sb) != 0) return 1;
+        if (op[1] == 'f') return S_ISREG(sb.st_mode) ? 0 : 1;
+        if (op[1] == 'd') return S_ISDIR(sb.st_mode) ? 0 : 1;
+        if (op[1] == 's') return sb.st_size > 0 ? 0 : 1;
+        return 0;
+    }
+
+    fprintf(stderr, "%s: %s: unary operator expected\n", name, op);
+    return 2;
+}
+
+static bool is_binary_op(const char *op) {
+    static const char *ops[] = { "=", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(op, ops[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to evaluate test's two-operand checks, 2 means a bad number
+static int test_binary(const char *name, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0) return strcmp(a, b) == 0 ? 0 : 1;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0 ? 0 : 1;
+
+    char *end_a, *end_b;
+    long x = strtol(a, &end_a, 10);
+    long y = strtol(b, &end_b, 10);
+    if (*a == '\0' || *end_a != '\0' || *b == '\0' || *end_b != '\0') {
+        fprintf(stderr, "%s: integer expression expected\n", name);
+        return 2;
+    }
+
+    switch (op[1] << 8 | op[2]) {
+        case 'e' << 8 | 'q': return x == y ? 0 : 1;
+        case 'n' << 8 | 'e': return x != y ? 0 : 1;
+        case 'l' << 8 | 't': return x < y ? 0 : 1;
+        case 'l' << 8 | 'e': return x <= y ? 0 : 1;
+        case 'g' << 8 | 't': return x > y ? 0 : 1;
+        default:             return x >= y ? 0 : 1;
+    }
+}
+
+// Function to evaluate a test expression by its number of arguments,
+// the way POSIX spells it out for up to four
+static int test_eval(const char *name, int argc, char **argv) {
+    int rc;
+
+    switch (argc) {
+        case 0:
+            return 1;
+        case 1:
+            return argv[0][0] != '\0' ? 0 : 1;
+        case 2:
+            if (strcmp(argv[0], "!") == 0) {
+                rc = test_eval(name, 1, argv + 1);
+                return rc == 2 ? 2 : !rc;
+            }
+            return test_unary(name, argv[0], argv[1]);
+        case 3:
+            if (is_binary_op(argv[1])) {
+                return test_binary(name, argv[0], argv[1], argv[2]);
             }
+            if (strcmp(argv[0], "!") == 0) {
+                rc = test_eval(name, 2, argv + 1);
+                return rc == 2 ? 2 : !rc;
+            }
+            break;
+        case 4:
+            if (strcmp(argv[0], "!") == 0) {
+                rc = test_eval(name, 3, argv + 1);
+                return rc == 2 ? 2 : !rc;
+            }
+            break;
+    }
+
+    fprintf(stderr, "%s: too many arguments\n", name);
+    return 2;
+}
+
+static int bi_test(cmd_buff_t *cmd) {
+    int argc = cmd->argc - 1;
+
+    // [ is test with a closing ] on the end
+    if (strcmp(cmd->argv[0], "[") == 0) {
+        if (argc == 0 || strcmp(cmd->argv[argc], "]") != 0) {
+            fprintf(stderr, "[: missing ]\n");
+            return 2;
         }
+        argc--;
     }
+    return test_eval(cmd->argv[0], argc, cmd->argv + 1);
+}
 
-    clist->num = cmd_count;
+typedef struct builtin {
+    const char *name;
+    builtin_fn_t fn;
+} builtin_t;
+
+static const builtin_t builtins[] = {
+    { "echo",  bi_echo },
+    { "pwd",   bi_pwd },
+    { "true",  bi_true },
+    { "false", bi_false },
+    { "test",  bi_test },
+    { "[",     bi_test },
+};
+
+// Function to look a command up in the fork-free built in registry
+builtin_fn_t find_builtin(const char *name) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return builtins[i].fn;
+        }
+    }
+    return NULL;
+}
 
-    if (clist->num == 0) {
-        printf("Warning: No commands provided\n");
-        free(command_copy);
-        return WARN_NO_CMDS;
+// Function to run a registry built in inside the shell, with stdout
+// swapped onto out_fd for the length of the call (-1 leaves it alone)
+static int run_builtin(builtin_fn_t fn, cmd_buff_t *cmd, int out_fd) {
+    int saved = -1;
+    int rc;
+
+    // A reader that went away must fail the write, not kill the shell
+    void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    if (out_fd != -1) {
+        saved = dup(STDOUT_FILENO);
+        if (saved == -1 || dup2(out_fd, STDOUT_FILENO) == -1) {
+            perror("dup2 output");
+            if (saved != -1) {
+                close(saved);
+            }
+            signal(SIGPIPE, old_pipe);
+            return 1;
+        }
     }
 
-    free(command_copy);
-    return OK;
+    rc = fn(cmd);
+
+    if (saved != -1) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    signal(SIGPIPE, old_pipe);
+    return rc;
 }
 
 int execute_pipeline(command_list_t *clist) {
@@ -353,44 +861,82 @@ int execute_pipeline(command_list_t *clist) {
 
     int pipes[clist->num - 1][2];  
     pid_t pids[clist->num];
+    builtin_fn_t fns[clist->num];
+    int stage_rc = 0;
 
     for (int i = 0; i < clist->num - 1; i++) {
         if (pipe(pipes[i]) == -1) {
             perror("pipe");
             return ERR_MEMORY;
         }
+
+        // Only the file actions hand a pipe end to a child
+        fcntl(pipes[i][0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipes[i][1], F_SETFD, FD_CLOEXEC);
     }
 
     for (int i = 0; i < clist->num; i++) {
-
         if (clist->commands[i].argv[0] == NULL) {
             fprintf(stderr, "Error: NULL command detected at index %d!\n", i);
             return ERR_MEMORY;
         }
+        pids[i] = -1;
+    }
 
-        pids[i] = fork();
-        if (pids[i] == -1) {
-            perror("fork");
-            return ERR_MEMORY;
+    // A built in runs in the shell unless the stage after it does too.
+    // That stage never reads the pipe, so the shell could block filling it.
+    for (int i = clist->num - 1; i >= 0; i--) {
+        fns[i] = find_builtin(clist->commands[i].argv[0]);
+        if (fns[i] != NULL && i < clist->num - 1 && fns[i + 1] != NULL) {
+            fns[i] = NULL;
         }
+    }
 
-        if (pids[i] == 0) {  // Child process
-            if (i > 0) {
-                dup2(pipes[i-1][0], STDIN_FILENO);  
+    // External stages are spawned first, so every pipe a built in writes
+    // to already has its reader running
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < clist->num; i++) {
+            int in_fd, out_fd, rc;
+
+            if ((fns[i] != NULL) != (pass == 1)) {
+                continue;
             }
 
-            if (i < clist->num - 1) {
-                dup2(pipes[i][1], STDOUT_FILENO);  
+            // A stage that can't start is left out, like a child that exits
+            if (open_redirects(&clist->commands[i], &in_fd, &out_fd) != OK) {
+                if (i == clist->num - 1) {
+                    stage_rc = EXIT_FAILURE;
+                }
+                continue;
             }
 
-            for (int j = 0; j < clist->num - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
+            // Redirection files take over from the pipes
+            int stdin_fd = in_fd != -1 ? in_fd : (i > 0 ? pipes[i-1][0] : -1);
+            int stdout_fd = out_fd != -1 ? out_fd : (i < clist->num - 1 ? pipes[i][1] : -1);
+
+            // Built ins never read stdin, so only stdout needs swapping
+            if (fns[i] != NULL) {
+                rc = run_builtin(fns[i], &clist->commands[i], stdout_fd);
+                if (i == clist->num - 1) {
+                    stage_rc = rc;
+                }
+            } else {
+                rc = spawn_cmd(&clist->commands[i], stdin_fd, stdout_fd, &pids[i]);
+                if (rc != 0) {
+                    pids[i] = -1;
+                    rc = launch_error(rc);
+                    if (i == clist->num - 1) {
+                        stage_rc = rc;
+                    }
+                }
             }
 
-            execvp(clist->commands[i].argv[0], clist->commands[i].argv);
-            perror("execvp");
-            exit(EXIT_FAILURE);
+            if (in_fd != -1) {
+                close(in_fd);
+            }
+            if (out_fd != -1) {
+                close(out_fd);
+            }
         }
     }
 
@@ -399,41 +945,23 @@ int execute_pipeline(command_list_t *clist) {
         close(pipes[i][1]);
     }
 
+    // The last command's exit code is the pipeline's, for rc
     for (int i = 0; i < clist->num; i++) {
-        waitpid(pids[i], NULL, 0);
-    }
+        int status;
 
-    return OK;
-}
-
-int exec_cmd(cmd_buff_t *cmd_buff) {
-    if (cmd_buff->input_redirect) {
-        if (dup2(cmd_buff->input_fd, STDIN_FILENO) == -1) {
-            perror("dup2 input failed");
-            return ERR_EXEC_CMD;
+        if (pids[i] == -1) {
+            if (i == clist->num - 1) {
+                last_status = stage_rc;
+            }
+            continue;
         }
-    }
-
-    if (cmd_buff->output_redirect) {
-        if (dup2(cmd_buff->output_fd, STDOUT_FILENO) == -1) {
-            perror("dup2 output failed");
-            return ERR_EXEC_CMD;
+        waitpid(pids[i], &status, 0);
+        if (i == clist->num - 1) {
+            last_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
         }
     }
 
-    // Close any open file descriptors after redirection
-    if (cmd_buff->input_fd != -1) {
-        close(cmd_buff->input_fd);
-    }
-    if (cmd_buff->output_fd != -1) {
-        close(cmd_buff->output_fd);
-    }
-
-    execvp(cmd_buff->argv[0], cmd_buff->argv);
-
-    // If execvp fails
-    perror("execvp failed");
-    return ERR_EXEC_CMD;
+    return OK;
 }
 
 
@@ -443,7 +971,6 @@ int exec_local_cmd_loop() {
     char *cmd_line = NULL;
     size_t len = 0;
     ssize_t read;
-    cmd_buff_t cmd_buff;
     command_list_t clist;
 
     while (1) {
@@ -464,102 +991,30 @@ int exec_local_cmd_loop() {
             continue;
         }
 
-        clear_cmd_buff(&cmd_buff);
-        if (build_cmd_buff(cmd_line, &cmd_buff) != OK) {
-            free(cmd_line);
-            return ERR_MEMORY;
-        }
+        // Nothing parsed from the previous line is used any more
+        reset_cmd_arena();
 
-        Built_In_Cmds built_in_cmd = exec_built_in_cmd(&cmd_buff);
-        if (built_in_cmd != BI_NOT_BI) {
-            if (built_in_cmd == BI_CMD_EXIT) {
-                break;
-            }
-            last_status = OK;
-            continue; // Skip external command/pipeline processing
+        // The parser has already said what was wrong with a bad line
+        if (build_cmd_list(cmd_line, &clist) != OK) {
+            continue;
         }
 
-        if (strchr(cmd_line, '|')) {
-            if (build_cmd_list(cmd_line, &clist) != OK) {
-                free(cmd_line);
-                return ERR_MEMORY;
-            }
-            execute_pipeline(&clist);
-        } else {
-            pid_t pid = fork();
-            if (pid == 0) {  // Child process
-                // Special handling for echo command: remove quotes if present
-                if (strcmp(cmd_buff.argv[0], "echo") == 0) {
-                    // Check if the first argument has quotes around it
-                    char *arg = cmd_buff.argv[1];
-                    if (arg && arg[0] == '"' && arg[strlen(arg) - 1] == '"') {
-                        // Remove the closing quote
-                        arg[strlen(arg) - 1] = '\0';
-                        // Shift the string to remove the opening quote
-                        memmove(arg, arg + 1, strlen(arg));  
-                    }
-                }
-
-                // Handle input redirection
-                if (cmd_buff.input_redirect) {
-                    if (dup2(cmd_buff.input_fd, STDIN_FILENO) == -1) {
-                        perror("dup2 input");
-                        exit(EXIT_FAILURE);
-                    }
-                    close(cmd_buff.input_fd);
-                }
-
-                // Handle output redirection
-                if (cmd_buff.output_redirect) {
-                    if (cmd_buff.output_redirect == 1) {  // Overwrite
-                        if (dup2(cmd_buff.output_fd, STDOUT_FILENO) == -1) {
-                            perror("dup2 output");
-                            exit(EXIT_FAILURE);
-                        }
-                    } else if (cmd_buff.output_redirect == 2) {  // Append
-                        if (dup2(cmd_buff.output_fd, STDOUT_FILENO) == -1) {
-                            perror("dup2 append output");
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    close(cmd_buff.output_fd);
-                }
-
-                // Execute the command
-                if (execvp(cmd_buff.argv[0], cmd_buff.argv) == -1) {
-                    switch (errno) {
-                        case ENOENT:
-                            fprintf(stderr, "Command not found in PATH\n");
-                            exit(2);
-                        case EACCES:
-                            fprintf(stderr, "Permission denied\n");
-                            exit(13);
-                        default:
-                            fprintf(stderr, "Failed to execute command: %s\n", strerror(errno));
-                            exit(1);
-                    }
+        if (clist.num == 1) {
+            Built_In_Cmds built_in_cmd = exec_built_in_cmd(&clist.commands[0]);
+            if (built_in_cmd != BI_NOT_BI) {
+                if (built_in_cmd == BI_CMD_EXIT) {
+                    break;
                 }
-            } else if (pid > 0) {
-                int status;
-                waitpid(pid, &status, 0);
-                if (WIFEXITED(status)) {
-                    last_status = WEXITSTATUS(status);
-                } else {
-                    last_status = -1;
-                }
-            } else {
-                perror("fork failed");
-                free(cmd_line);
-                return ERR_MEMORY;
+                last_status = OK;
+                continue; // Skip external command/pipeline processing
             }
         }
 
-        // Clean up allocated memory for arguments
-        for (int i = 0; i < cmd_buff.argc; i++) {
-            free(cmd_buff.argv[i]);
-        }
+        // A single command is just a pipeline of one
+        execute_pipeline(&clist);
     }
 
+    clear_cmd_hash();
     free(cmd_line);
     return OK;
 }
@@ -1,6 +1,9 @@
 #ifndef __DSHLIB_H__
     #define __DSHLIB_H__
 
+#include <stddef.h>
+#include <stdbool.h>
+
 
 //Constants for command structure sizes
 #define EXE_MAX 64
@@ -20,10 +23,9 @@ typedef struct cmd_buff {
     int argc;
     char *argv[CMD_ARGV_MAX];
     char *_cmd_buffer;
-    int input_fd;     // For input redirection
-    int output_fd;    // For output redirection
-    int input_redirect;  // Flag to check if input redirection is required
-    int output_redirect; // Flag to check if output redirection is required
+    char *input_file;  // stores input redirection file (for `<`)
+    char *output_file; // stores output redirection file (for `>` and `>>`)
+    bool append_mode;  // sets append mode for output_file
 } cmd_buff_t;
 
 
@@ -37,6 +39,17 @@ typedef struct command{
 }command_t;
 */
 
+//Every string the parser makes for a command line is carved out of one
+//arena, so parsing never calls malloc and reset_cmd_arena() throws the
+//whole line away in O(1) before the next one is read
+#define CMD_ARENA_SZ    (64 * 1024)
+
+typedef struct cmd_arena {
+    char   *base;
+    size_t  used;
+    size_t  size;
+} cmd_arena_t;
+
 typedef struct command_list{
     int num;
     cmd_buff_t commands[CMD_MAX];
@@ -60,6 +73,7 @@ typedef struct command_list{
 #define ERR_MEMORY              -5
 #define ERR_EXEC_CMD            -6
 #define OK_EXIT                 -7
+#define ERR_CMD_TOO_BIG         -8      //line does not fit the parse arena
 
 //prototypes
 int alloc_cmd_buff(cmd_buff_t *cmd_buff);
@@ -70,6 +84,14 @@ int close_cmd_buff(cmd_buff_t *cmd_buff);
 int build_cmd_list(char *cmd_line, command_list_t *clist);
 int free_cmd_list(command_list_t *cmd_lst);
 
+//parse arena
+char *arena_alloc(cmd_arena_t *arena, size_t size);
+void reset_cmd_arena(void);
+
+//command path cache, see the hash built in
+const char *find_cmd_path(const char *name);
+void clear_cmd_hash(void);
+
 //built in command stuff
 typedef enum {
     BI_CMD_EXIT,
@@ -81,9 +103,12 @@ typedef enum {
 Built_In_Cmds match_command(const char *input); 
 Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd);
 
+//fork-free built ins the shell runs itself, they return an exit code
+typedef int (*builtin_fn_t)(cmd_buff_t *cmd);
+builtin_fn_t find_builtin(const char *name);
+
 //main execution context
 int exec_local_cmd_loop();
-int exec_cmd(cmd_buff_t *cmd);
 int execute_pipeline(command_list_t *clist);
 
 
@@ -92,6 +117,11 @@ int execute_pipeline(command_list_t *clist);
 //output constants
 #define CMD_OK_HEADER       "PARSED COMMAND LINE - TOTAL COMMANDS %d\n"
 #define CMD_WARN_NO_CMD     "warning: no commands provided\n"
+#define CMD_ERR_NO_CMD      "error: missing command\n"
 #define CMD_ERR_PIPE_LIMIT  "error: piping limited to %d commands\n"
+#define CMD_ERR_TOO_BIG     "error: command line too long\n"
+#define CMD_ERR_ARGS_LIMIT  "error: commands limited to %d arguments\n"
+#define CMD_ERR_EMPTY_PIPE  "error: empty command in pipeline\n"
+#define CMD_ERR_REDIRECT    "error: missing file name after redirection\n"
 
 #endif
\ No newline at end of file
@@ -13,7 +13,7 @@ EOF
     stripped_output=$(echo "$output" | tr -d '[:space:]')
 
     # Expected output with all whitespace removed for easier matching
-    expected_output="dshlib.cdsh3>dsh3>cmdloopreturned0"
+    expected_output="1dsh3>dsh3>cmdloopreturned0"
 
     # These echo commands will help with debugging and will only print
     #if the test fails
@@ -114,4 +114,95 @@ EOF
   # Verify the output is what we expect (the content from out.txt, without quotes)
   [ "$status" -eq 0 ]
   [ "$output" == "hello, class" ]
+}
+
+@test "Command line longer than the parse arena is rejected" {
+    long_line="echo $(head -c 70000 /dev/zero | tr '\0' 'a')"
+    run ./dsh <<EOF
+$long_line
+echo still running
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ "error: command line too long" ]]
+    [[ "$output" =~ "still running" ]]
+}
+
+@test "Quoted pipe and redirection characters stay in the argument" {
+    run ./dsh <<EOF
+echo "a | b > c" | cat
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ "a | b > c" ]]
+    [ ! -f c ]
+}
+
+@test "launchbench times fork+exec and posix_spawn" {
+    run ./dsh <<EOF
+launchbench 20
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ "fork+exec    20 launches" ]]
+    [[ "$output" =~ "posix_spawn  20 launches" ]]
+}
+
+@test "hash caches command paths and counts hits" {
+    run ./dsh <<EOF
+ls > /dev/null
+ls > /dev/null
+hash nosuchcommand
+hash
+hash -r
+hash
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ $'2\t'[^[:space:]]*/ls ]]
+    [[ "$output" =~ "hash: nosuchcommand: not found" ]]
+    [[ "$output" =~ "hash: hash table empty" ]]
+}
+
+@test "echo, pwd, true, false and test run inside the shell" {
+    # With nothing on PATH only the built ins can still run
+    PATH=/nonexistent run ./dsh <<EOF
+cd /
+pwd
+echo "built in" > /tmp/dsh_builtin_out.txt
+test -s /tmp/dsh_builtin_out.txt
+rc
+[ 1 -gt 2 ]
+rc
+true
+rc
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="/dsh3>dsh3>dsh3>dsh3>dsh3>0dsh3>dsh3>1dsh3>dsh3>0dsh3>cmdloopreturned0"
+
+    echo "Output: $output"
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$(cat /tmp/dsh_builtin_out.txt)" = "built in" ]
+    rm -f /tmp/dsh_builtin_out.txt
+    [ "$status" -eq 0 ]
+}
+
+@test "A redirection with no command reports a missing command" {
+    run ./dsh <<EOF
+> dsh_no_cmd.txt
+echo a | > dsh_no_cmd.txt
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="dsh3>error:missingcommanddsh3>error:emptycommandinpipelinedsh3>cmdloopreturned0"
+
+    echo "Output: $output"
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ ! -f dsh_no_cmd.txt ]
+    [ "$status" -eq 0 ]
 }
\ No newline at end of file
@@ -297,6 +297,7 @@ int process_cli_requests(int svr_socket) {
             break;      //leave loop, close connection
         }
 
+        reset_cmd_arena();
         rc = build_cmd_list((char *)io_buff, &cmd_list);
         switch (rc) {
             case ERR_MEMORY:
@@ -307,10 +308,22 @@ int process_cli_requests(int svr_socket) {
                 sprintf((char *)io_buff, CMD_ERR_RDSH_ITRNL, WARN_NO_CMDS);
                 send_message_string(cli_socket, (char *)io_buff);
                 continue;
+            case ERR_CMD_TOO_BIG:
+                sprintf((char *)io_buff, CMD_ERR_TOO_BIG);
+                send_message_string(cli_socket, (char *)io_buff);
+                continue;
             case ERR_CMD_OR_ARGS_TOO_BIG:
+                sprintf((char *)io_buff, CMD_ERR_ARGS_LIMIT, CMD_ARGV_MAX - 1);
+                send_message_string(cli_socket, (char *)io_buff);
+                continue;
+            case ERR_TOO_MANY_COMMANDS:
                 sprintf((char *)io_buff, CMD_ERR_PIPE_LIMIT, CMD_MAX);
                 send_message_string(cli_socket, (char *)io_buff);
                 continue;
+            case ERR_CMD_ARGS_BAD:
+                sprintf((char *)io_buff, CMD_ERR_RDSH_ITRNL, ERR_CMD_ARGS_BAD);
+                send_message_string(cli_socket, (char *)io_buff);
+                continue;
             default:
                 break;
         }
@@ -606,6 +619,11 @@ int send_message_string(int cli_socket, char *buff) {
                 close(pipe_fds[j]);
             }
 
+            // Redirection files take over from the socket and pipes
+            if (apply_redirects(&clist->commands[i]) != OK) {
+                exit(EXIT_FAILURE);
+            }
+
             // Execute the command with arguments
             execvp(clist->commands[i].argv[0], clist->commands[i].argv);
             perror("execvp failed");
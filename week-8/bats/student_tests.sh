@@ -18,7 +18,7 @@ EOF
     stripped_output=$(echo "$output" | tr -d '[:space:]')
 
     # Expected output with all whitespace removed for easier matching
-    expected_output="dshlib.clocalmodedsh4>dsh4>cmdloopreturned0"
+    expected_output="1localmodedsh4>dsh4>cmdloopreturned0"
 
     # These echo commands will help with debugging and will only print
     #if the test fails
@@ -64,6 +64,97 @@ EOF
     [ "$status" -eq 0 ]
 }
 
+@test "Command line longer than the parse arena is rejected" {
+    long_line="echo $(head -c 70000 /dev/zero | tr '\0' 'a')"
+    run ./dsh <<EOF
+$long_line
+echo still running
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ "error: command line too long" ]]
+    [[ "$output" =~ "still running" ]]
+}
+
+@test "Quoted pipe and redirection characters stay in the argument" {
+    run ./dsh <<EOF
+echo "a | b > c" | cat
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ "a | b > c" ]]
+    [ ! -f c ]
+}
+
+@test "launchbench times fork+exec and posix_spawn" {
+    run ./dsh <<EOF
+launchbench 20
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ "fork+exec    20 launches" ]]
+    [[ "$output" =~ "posix_spawn  20 launches" ]]
+}
+
+@test "hash caches command paths and counts hits" {
+    run ./dsh <<EOF
+ls > /dev/null
+ls > /dev/null
+hash nosuchcommand
+hash
+hash -r
+hash
+EOF
+
+    [ "$status" -eq 0 ]
+    [[ "$output" =~ $'2\t'[^[:space:]]*/ls ]]
+    [[ "$output" =~ "hash: nosuchcommand: not found" ]]
+    [[ "$output" =~ "hash: hash table empty" ]]
+}
+
+@test "echo, pwd, true, false and test run inside the shell" {
+    # With nothing on PATH only the built ins can still run
+    PATH=/nonexistent run ./dsh <<EOF
+cd /
+pwd
+echo "built in" > /tmp/dsh_builtin_out.txt
+test -s /tmp/dsh_builtin_out.txt
+rc
+[ 1 -gt 2 ]
+rc
+true
+rc
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="/localmodedsh4>dsh4>dsh4>dsh4>dsh4>0dsh4>dsh4>1dsh4>dsh4>0dsh4>cmdloopreturned0"
+
+    echo "Output: $output"
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ "$(cat /tmp/dsh_builtin_out.txt)" = "built in" ]
+    rm -f /tmp/dsh_builtin_out.txt
+    [ "$status" -eq 0 ]
+}
+
+@test "A redirection with no command reports a missing command" {
+    run ./dsh <<EOF
+> dsh_no_cmd.txt
+echo a | > dsh_no_cmd.txt
+EOF
+
+    stripped_output=$(echo "$output" | tr -d '[:space:]')
+    expected_output="localmodedsh4>error:missingcommanddsh4>error:emptycommandinpipelinedsh4>cmdloopreturned0"
+
+    echo "Output: $output"
+    echo "${stripped_output} -> ${expected_output}"
+
+    [ "$stripped_output" = "$expected_output" ]
+    [ ! -f dsh_no_cmd.txt ]
+    [ "$status" -eq 0 ]
+}
+
 #################################
 ### Functions for client-server checks
 #### Denoted as remote
@@ -143,6 +234,19 @@ EOF
   [[ "$output" =~ "/" ]]
 }
 
+@test "Remote: argument limit error reaches the client" {
+  ./dsh -s -i $REMOTE_IP -p $REMOTE_PORT & # Start server in background
+  sleep 1 # Wait for server to start
+
+  run ./dsh -c -i $REMOTE_IP -p $REMOTE_PORT <<EOF
+echo 1 2 3 4 5 6 7 8 9
+exit
+EOF
+
+  [ "$status" -eq 0 ]
+  [[ "$output" =~ "error: commands limited to 8 arguments" ]]
+}
+
 @test "Remote: Stop server check" {
     run ./dsh -c -i $REMOTE_IP -p $REMOTE_PORT <<EOF
 stop-server
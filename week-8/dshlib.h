@@ -1,6 +1,8 @@
 #ifndef __DSHLIB_H__
     #define __DSHLIB_H__
 
+#include <stddef.h>
+
 
 //Constants for command structure sizes
 #define EXE_MAX 64
@@ -18,29 +20,26 @@ typedef struct command
 
 #include <stdbool.h>
 
-/*typedef struct cmd_buff
-{
-    int  argc;
-    char *argv[CMD_ARGV_MAX];
-    char *_cmd_buffer;
-    char *input_file;  // extra credit, stores input redirection file (for `<`)
-    char *output_file; // extra credit, stores output redirection file (for `>`)
-    bool append_mode; // extra credit, sets append mode fomr output_file
-} cmd_buff_t;*/
-
-
-//this is what i had for assignment 7
 typedef struct cmd_buff {
     int argc;
     char *argv[CMD_ARGV_MAX];
     char *_cmd_buffer;
-    int input_fd;     // For input redirection
-    int output_fd;    // For output redirection
-    int input_redirect;  // Flag to check if input redirection is required
-    int output_redirect; // Flag to check if output redirection is required
-    bool append_mode; // extra credit, sets append mode fomr output_file
+    char *input_file;  // stores input redirection file (for `<`)
+    char *output_file; // stores output redirection file (for `>` and `>>`)
+    bool append_mode;  // sets append mode for output_file
 } cmd_buff_t;
 
+//Every string the parser makes for a command line is carved out of one
+//arena, so parsing never calls malloc and reset_cmd_arena() throws the
+//whole line away in O(1) before the next one is read
+#define CMD_ARENA_SZ    (64 * 1024)
+
+typedef struct cmd_arena {
+    char   *base;
+    size_t  used;
+    size_t  size;
+} cmd_arena_t;
+
 typedef struct command_list{
     int num;
     cmd_buff_t commands[CMD_MAX];
@@ -65,6 +64,7 @@ typedef struct command_list{
 #define ERR_MEMORY              -5
 #define ERR_EXEC_CMD            -6
 #define OK_EXIT                 -7
+#define ERR_CMD_TOO_BIG         -8      //line does not fit the parse arena
 
 
 
@@ -74,9 +74,18 @@ int free_cmd_buff(cmd_buff_t *cmd_buff);
 int clear_cmd_buff(cmd_buff_t *cmd_buff);
 int build_cmd_buff(char *cmd_line, cmd_buff_t *cmd_buff);
 int close_cmd_buff(cmd_buff_t *cmd_buff);
+int apply_redirects(cmd_buff_t *cmd);
 int build_cmd_list(char *cmd_line, command_list_t *clist);
 void free_cmd_list(command_list_t *cmd_lst);
 
+//parse arena
+char *arena_alloc(cmd_arena_t *arena, size_t size);
+void reset_cmd_arena(void);
+
+//command path cache, see the hash built in
+const char *find_cmd_path(const char *name);
+void clear_cmd_hash(void);
+
 //built in command stuff
 typedef enum {
     BI_CMD_EXIT,
@@ -91,6 +100,10 @@ typedef enum {
 Built_In_Cmds match_command(const char *input); 
 Built_In_Cmds exec_built_in_cmd(cmd_buff_t *cmd);
 
+//fork-free built ins the shell runs itself, they return an exit code
+typedef int (*builtin_fn_t)(cmd_buff_t *cmd);
+builtin_fn_t find_builtin(const char *name);
+
 //main execution context
 int exec_local_cmd_loop();
 int exec_cmd(cmd_buff_t *cmd);
@@ -100,7 +113,12 @@ int execute_pipeline(command_list_t *clist);
 //output constants
 #define CMD_OK_HEADER       "PARSED COMMAND LINE - TOTAL COMMANDS %d\n"
 #define CMD_WARN_NO_CMD     "warning: no commands provided\n"
+#define CMD_ERR_NO_CMD      "error: missing command\n"
 #define CMD_ERR_PIPE_LIMIT  "error: piping limited to %d commands\n"
+#define CMD_ERR_TOO_BIG     "error: command line too long\n"
+#define CMD_ERR_ARGS_LIMIT  "error: commands limited to %d arguments\n"
+#define CMD_ERR_EMPTY_PIPE  "error: empty command in pipeline\n"
+#define CMD_ERR_REDIRECT    "error: missing file name after redirection\n"
 
 
 #endif
\ No newline at end of file